@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "analyze_batdetector.h"
+
+void AudioAnalyzeBatDetector::push(const batcall_event &ev)
+{
+	uint8_t head = queue_head;
+	uint8_t next = (head + 1) & (BATDETECTOR_QUEUE_SIZE - 1);
+	if (next == queue_tail) {
+		dropped_events++;
+		return;
+	}
+	queue[head] = ev;
+	__sync_synchronize(); // event is complete before it is published
+	queue_head = next;
+}
+
+void AudioAnalyzeBatDetector::analyzed(const uint16_t *bins, uint32_t sample)
+{
+	int half = size / 2;
+	if (band_req || band_size != size) {
+		noise_req |= (band_size != size);
+		band_req = false;
+		band_size = size;
+		float binwidth = sample_rate / size;
+		lo_bin = band_lo / binwidth + 0.5;
+		hi_bin = band_hi / binwidth + 0.5;
+		if (lo_bin < 2) lo_bin = 2; // DC and the bin next to it
+		if (hi_bin > half - 1) hi_bin = half - 1;
+		max_call_samples = sample_rate * (BATDETECTOR_MAX_CALL / 1000.0);
+		max_gap_samples = sample_rate * (BATDETECTOR_MAX_GAP / 1000.0);
+	}
+
+	// the peak is the bin the furthest above its noise floor
+	int32_t excess = 0x80000000;
+	int peak_bin = lo_bin;
+	for (int i = lo_bin; i <= hi_bin; i++) {
+		int32_t e = (bins[i] << 8) - (int32_t)noise[i];
+		if (e > excess) {
+			excess = e;
+			peak_bin = i;
+		}
+	}
+	uint16_t peak = bins[peak_bin];
+	bool detected = peak >= min_level &&
+		((uint64_t)peak << 16) >= (uint64_t)noise[peak_bin] * ratio;
+
+	if (noise_req) {
+		noise_req = false;
+		noise_frames = 0;
+	}
+	if (noise_frames < BATDETECTOR_NOISE_START) {
+		// sum the first frames, then scale the sum to the mean in Q8
+		if (noise_frames == 0) {
+			for (int i = 0; i < half; i++) noise[i] = 0;
+		}
+		for (int i = 0; i < half; i++) noise[i] += bins[i];
+		if (++noise_frames == BATDETECTOR_NOISE_START) {
+			for (int i = 0; i < half; i++) noise[i] = (noise[i] << 8) / BATDETECTOR_NOISE_START;
+			keep_open = false;
+		}
+		detected = false;
+	} else {
+		// a call holds the floor, unless it goes on too long to be one
+		bool hold = detected && (!in_call || sample - call_start_sample < max_call_samples);
+		if (!hold) {
+			for (int i = 0; i < half; i++) {
+				uint32_t n = noise[i];
+				uint32_t step = (n >> BATDETECTOR_NOISE_SHIFT) + 1;
+				if (((uint32_t)bins[i] << 8) > n) noise[i] = n + step;
+				else if (n >= step) noise[i] = n - step;
+			}
+		}
+	}
+
+	if (detected) {
+		int32_t f = refinePeak(peak_bin);
+
+		if (!in_call) {
+			batcall_event ev;
+			ev.type = BATCALL_START;
+			ev.bin = peak_bin;
+			ev.level = peak;
+			ev.freq = f * sample_rate / (size * 256.0);
+			ev.sample = sample;
+			push(ev);
+			call_frames = 0;
+			call_start_sample = sample;
+			call_interval = 0;
+			if (prev_start_valid && sample - prev_start_sample <
+				(uint32_t)(sample_rate * (BATDETECTOR_MAX_INTERVAL / 1000.0))) {
+				call_interval = sample - prev_start_sample;
+			}
+			prev_start_sample = sample;
+			prev_start_valid = true;
+			f_start = f;
+			f_prev = f;
+			f_min = f;
+			f_max = f;
+			f_peak = f;
+			peak_level = peak;
+			f_char = f;
+			char_step = 0x7FFFFFFF;
+		} else {
+			// the onset frame only holds the first part of the call, the
+			// step out of it is too small on a steep sweep
+			int32_t step = abs(f - f_prev);
+			if (call_frames > 1 && step <= char_step) {
+				char_step = step;
+				f_char = f;
+			}
+			f_prev = f;
+			if (f < f_min) f_min = f;
+			if (f > f_max) f_max = f;
+			if (peak > peak_level) {
+				peak_level = peak;
+				f_peak = f;
+			}
+		}
+		call_frames++;
+		call_bin = peak_bin;
+		call_f = f;
+		call_level = peak;
+		call_sample = sample;
+		in_call = true;
+	} else if (in_call && sample - call_sample > max_gap_samples) {
+		endCall();
+		in_call = false;
+	}
+}
+
+void AudioAnalyzeBatDetector::endCall(void)
+{
+	batcall_event ev;
+	float hz = sample_rate / (size * 256.0);
+	float ms = 1000.0 / sample_rate;
+
+	ev.type = BATCALL_END;
+	ev.bin = call_bin;
+	ev.level = call_level;
+	ev.freq = f_prev * hz;
+	ev.sample = call_sample;
+	ev.features.fstart = f_start * hz;
+	ev.features.fend = f_prev * hz;
+	ev.features.fpeak = f_peak * hz;
+	ev.features.fchar = f_char * hz;
+	ev.features.bandwidth = (f_max - f_min) * hz;
+	ev.features.duration = (call_sample - call_start_sample + hop) * ms;
+	ev.features.slope = (f_start - f_prev) * hz * 0.001 / ev.features.duration;
+	ev.features.interval = call_interval * ms;
+	ev.features.frames = call_frames;
+	push(ev);
+}
+
+// Jacobsen's estimator, the real part of
+// (X[k-1] - X[k+1]) / (2 X[k] - X[k-1] - X[k+1]), times a factor for the
+// window that was fitted on tones between the bins; batdetector_test on
+// the host prints the best fit. Returns bins Q8.
+int32_t AudioAnalyzeBatDetector::refinePeak(int bin)
+{
+	// Hann, Blackman-Harris, Kaiser
+	static const float window_factor[3] = {2.0, 3.2, 2.4};
+	const int16_t *x = complexBins() + bin * 2;
+	float num_re = x[-2] - x[2];
+	float num_im = x[-1] - x[3];
+	float den_re = 2 * x[0] - x[-2] - x[2];
+	float den_im = 2 * x[1] - x[-1] - x[3];
+	float den = den_re * den_re + den_im * den_im;
+	if (den == 0.0) return bin << 8;
+	float delta = window_factor[window_type] * (num_re * den_re + num_im * den_im) / den;
+	if (delta > 0.5) delta = 0.5;
+	else if (delta < -0.5) delta = -0.5;
+	return (bin << 8) + (int32_t)(delta * 256.0);
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef analyze_batdetector_h_
+#define analyze_batdetector_h_
+
+#include "analyze_spectrum.h"
+
+// the noise floor of each bin moves 1/2^BATDETECTOR_NOISE_SHIFT of itself
+// per frame towards the input. At 256 points, 50% overlap and 281 kHz that
+// doubles it in 0.16 s while every frame is above it, in noise that is
+// above it half the time it takes about 0.4 s.
+#define BATDETECTOR_NOISE_SHIFT  9
+// longest call, ms. The noise floor does not rise during a call up to this
+// long, a tone that goes on longer is taken for noise.
+#define BATDETECTOR_MAX_CALL     100
+// frames averaged to start the noise floor, a power of 2
+#define BATDETECTOR_NOISE_START  64
+
+// longest gap inside a call, ms. Frames below the threshold for up to this
+// long do not end it: a steep FM sweep spreads over many bins per frame and
+// may drop below it for a few frames in noise.
+#define BATDETECTOR_MAX_GAP      2
+
+// longest inter-pulse interval, ms; calls further apart are not one sequence
+#define BATDETECTOR_MAX_INTERVAL 1000
+
+// call events waiting for the sketch, a power of 2
+#define BATDETECTOR_QUEUE_SIZE   32
+
+#define BATCALL_START            0
+#define BATCALL_END              1
+
+// call parameters, collected frame by frame from the peak of the band
+// interpolated between the bins
+struct batcall_features {
+	float fstart;       // Hz, first frame
+	float fend;         // Hz, last frame
+	float fpeak;        // Hz, frame with the highest level
+	float fchar;        // Hz, where the call is flattest, late frames win;
+	                    // the step out of the onset frame does not count
+	float bandwidth;    // Hz, highest minus lowest frequency
+	float duration;     // ms, first frame centre to last plus one hop
+	float slope;        // kHz/ms from fstart to fend, positive when falling
+	float interval;     // ms since the start of the previous call, 0 if
+	                    // that is more than BATDETECTOR_MAX_INTERVAL ago
+	uint16_t frames;
+};
+
+struct batcall_event {
+	uint8_t type;       // BATCALL_START or BATCALL_END
+	uint16_t bin;       // peak bin of the first or the last frame of the call
+	uint16_t level;     // magnitude of that bin
+	float freq;         // Hz, peak of that frame interpolated between the bins
+	uint32_t sample;    // input sample count at the centre of that frame. The
+	                    // call starts or ends within half a frame of it,
+	                    // 0.45 ms at 256 points and 281 kHz, the frame is
+	                    // the finest time the detector knows
+	batcall_features features; // BATCALL_END only
+};
+
+// Bat call detector: a spectrum analyzer that checks every frame for a peak
+// inside the call band that stands out from the noise floor of its bin. The
+// start and the end of each call are pushed into a queue with the sample
+// count of the frame, so detection keeps running in update() whatever the
+// sketch is drawing. The end is pushed, and inCall() turns false, once
+// BATDETECTOR_MAX_GAP has passed without a frame of the call. The end event
+// carries the parameters of the call, which are updated every frame in
+// constant memory. A full queue drops the event. Like the analyzer it only
+// runs once configure() has given it a buffer.
+// The noise floor is a running median per bin: it steps up when the bin is
+// above it and down when below, by a fixed fraction of itself. It starts
+// from the mean of the first frames, no calls are detected until then.
+// It does not rise during the first BATDETECTOR_MAX_CALL ms of a call, so
+// constant frequency calls that fill most of the time leave it where it
+// is. Insects, wind and gain changes are followed within seconds. It only
+// moves while frames are computed, a closed gate keeps it as it is.
+// The peak frequency comes from Jacobsen's estimator on the complex bins
+// around the peak, scaled for the window: within 30 to 60 Hz for a tone
+// in noise at 256 points and 281 kHz, where the bin alone is off by up to
+// half its 1.1 kHz.
+class AudioAnalyzeBatDetector : public AudioAnalyzeSpectrum
+{
+public:
+	AudioAnalyzeBatDetector(void) {
+		band_lo = 30000;
+		band_hi = 80000;
+		band_req = true;
+		band_size = 0;
+		ratio = 6 * 256;
+		min_level = 4;
+		in_call = false;
+		call_bin = 0;
+		call_f = 0;
+		call_frames = 0;
+		prev_start_valid = false;
+		noise_req = true;
+		keep_open = true;
+		queue_head = 0;
+		queue_tail = 0;
+		dropped_events = 0;
+	}
+	// the rate the codec really runs at, for the band, the gate and
+	// peakFrequency()
+	void setSampleRate(float rate) {
+		AudioAnalyzeSpectrum::setSampleRate(rate);
+		band_req = true;
+	}
+	// calls are searched between lo and hi Hz
+	void band(float lo, float hi) {
+		if (lo < 0.0) lo = 0.0;
+		if (hi < lo) hi = lo;
+		band_lo = lo;
+		band_hi = hi;
+		band_req = true;
+	}
+	// a frame belongs to a call when its peak in the band is at least
+	// ratio times the noise floor of that bin
+	void threshold(float n) {
+		if (n < 1.0) n = 1.0;
+		else if (n > 255.0) n = 255.0;
+		ratio = n * 256.0 + 0.5;
+	}
+	// oldest waiting event, false if there is none
+	bool readEvent(batcall_event *ev) {
+		uint8_t tail = queue_tail;
+		if (tail == queue_head) return false;
+		__sync_synchronize(); // read the event after its publication
+		*ev = queue[tail];
+		queue_tail = (tail + 1) & (BATDETECTOR_QUEUE_SIZE - 1);
+		return true;
+	}
+	// start the noise floor again from the next frame
+	void resetNoise(void) {
+		noise_req = true;
+		keep_open = true; // learn it with the gate open
+	}
+	// noise floor of a bin, in the units of the analyzer output
+	uint16_t noiseFloor(int bin) {
+		if (bin < 0 || bin >= size / 2) return 0;
+		return noise[bin] >> 8;
+	}
+	bool inCall(void) { return in_call; }
+	// peak of the latest frame of the running call, interpolated
+	float peakFrequency(void) {
+		if (size == 0) return 0.0;
+		return call_f * sample_rate / (size * 256.0);
+	}
+	// frames of the running call so far
+	uint32_t callFrames(void) { return call_frames; }
+	uint32_t droppedEvents(void) { return dropped_events; }
+protected:
+	virtual void analyzed(const uint16_t *bins, uint32_t sample);
+private:
+	void push(const batcall_event &ev);
+	void endCall(void);
+	int32_t refinePeak(int bin);
+	float band_lo;
+	float band_hi;
+	volatile bool band_req;
+	int lo_bin;
+	int hi_bin;
+	int band_size;      // size the bins were computed for
+	uint32_t max_call_samples;
+	uint32_t max_gap_samples;
+	volatile uint32_t ratio; // Q8
+	volatile bool noise_req;
+	uint16_t noise_frames; // frames summed so far while starting
+	uint32_t noise[SPECTRUM_MAX_SIZE / 2]; // Q8
+	uint16_t min_level;
+	volatile bool in_call;
+	volatile uint16_t call_bin;
+	volatile int32_t call_f; // bins Q8
+	volatile uint32_t call_frames;
+	uint16_t call_level;
+	uint32_t call_sample;
+	// running call parameters, frequencies in bins Q8
+	uint32_t call_start_sample;
+	uint32_t call_interval;  // samples, 0 if unknown
+	uint32_t prev_start_sample;
+	bool prev_start_valid;
+	int32_t f_start;
+	int32_t f_prev;
+	int32_t f_min;
+	int32_t f_max;
+	int32_t f_peak;
+	uint16_t peak_level;
+	int32_t f_char;
+	int32_t char_step;  // smallest frequency step between frames so far
+	// single producer (update), single consumer (the sketch)
+	batcall_event queue[BATDETECTOR_QUEUE_SIZE];
+	volatile uint8_t queue_head;
+	volatile uint8_t queue_tail;
+	volatile uint32_t dropped_events;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "analyze_goertzel.h"
+
+void AudioAnalyzeGoertzelBank::update(void)
+{
+	audio_block_t *block;
+
+	block = receiveReadOnly(0);
+	if (!block) return;
+
+	if (setup_req) {
+		setup_req = false;
+		window_blocks = window_req;
+		window_pos = 0;
+		filter_count = 0;
+		for (int n = 0; n < GOERTZEL_MAX_FILTERS; n++) {
+			float f = freq[n];
+			if (f > sample_rate / 2) f = sample_rate / 2;
+			coef[n] = cosf(2.0 * 3.14159265 * f / sample_rate) * 2147483647.0;
+			if (f > 0.0) filter_count = n + 1;
+			for (int j = 0; j < GOERTZEL_MAX_BLOCKS; j++) {
+				q1[n][j] = 0;
+				q2[n][j] = 0;
+			}
+		}
+	}
+	if (filter_count == 0) {
+		release(block);
+		return;
+	}
+
+	for (int n = 0; n < filter_count; n++) {
+		int32_t c = coef[n];
+		// the Goertzel of window_pos starts afresh with this block
+		q1[n][window_pos] = 0;
+		q2[n][window_pos] = 0;
+		for (int j = 0; j < window_blocks; j++) {
+			int32_t s1 = q1[n][j];
+			int32_t s2 = q2[n][j];
+			for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+				int32_t s0 = block->data[i] + (int32_t)(((int64_t)c * s1) >> 30) - s2;
+				s2 = s1;
+				s1 = s0;
+			}
+			q1[n][j] = s1;
+			q2[n][j] = s2;
+		}
+	}
+	release(block);
+
+	// the Goertzel that started right after window_pos is complete now
+	window_pos++;
+	if (window_pos >= window_blocks) window_pos = 0;
+	__disable_irq();
+	for (int n = 0; n < filter_count; n++) {
+		out_q1[n] = q1[n][window_pos];
+		out_q2[n] = q2[n][window_pos];
+		out_coef[n] = coef[n] * (1.0 / 1073741824.0);
+	}
+	out_len = window_blocks * AUDIO_BLOCK_SAMPLES;
+	new_output = true;
+	__enable_irq();
+}
+
+float AudioAnalyzeGoertzelBank::read(int n)
+{
+	if (n < 0 || n >= GOERTZEL_MAX_FILTERS) return 0.0;
+	__disable_irq();
+	float s1 = out_q1[n];
+	float s2 = out_q2[n];
+	float c = out_coef[n];
+	uint16_t len = out_len;
+	__enable_irq();
+	if (len == 0) return 0.0;
+	float power = s1 * s1 + s2 * s2 - c * s1 * s2;
+	if (power < 0.0) power = 0.0;
+	// a full scale sine gives len / 2 * 32768
+	return sqrtf(power) / (len * 16384.0);
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "analyze_spectrum.h"
+#include "utility/sqrt_integer.h"
+
+// first half (0 .. 512 of 1024) of the periodic windows, Q15
+static const int16_t spectrum_window_hann[SPECTRUM_MAX_SIZE / 2 + 1] = {
+	    0,     0,     1,     3,     5,     8,    11,    15,    20,    25,    31,    37,
+	   44,    52,    60,    69,    79,    89,   100,   111,   123,   136,   149,   163,
+	  177,   192,   208,   224,   241,   259,   277,   295,   315,   335,   355,   376,
+	  398,   420,   443,   467,   491,   516,   541,   567,   593,   621,   648,   677,
+	  705,   735,   765,   796,   827,   859,   891,   924,   958,   992,  1027,  1062,
+	 1098,  1134,  1171,  1209,  1247,  1286,  1325,  1365,  1406,  1447,  1488,  1530,
+	 1573,  1616,  1660,  1704,  1749,  1795,  1841,  1887,  1935,  1982,  2030,  2079,
+	 2128,  2178,  2229,  2279,  2331,  2383,  2435,  2488,  2542,  2596,  2650,  2706,
+	 2761,  2817,  2874,  2931,  2989,  3047,  3105,  3165,  3224,  3284,  3345,  3406,
+	 3468,  3530,  3592,  3655,  3719,  3783,  3847,  3912,  3978,  4044,  4110,  4177,
+	 4244,  4312,  4380,  4449,  4518,  4587,  4657,  4728,  4799,  4870,  4942,  5014,
+	 5086,  5159,  5233,  5307,  5381,  5456,  5531,  5606,  5682,  5759,  5835,  5912,
+	 5990,  6068,  6146,  6225,  6304,  6383,  6463,  6543,  6624,  6705,  6786,  6868,
+	 6950,  7032,  7115,  7198,  7281,  7365,  7449,  7534,  7618,  7703,  7789,  7875,
+	 7961,  8047,  8134,  8221,  8308,  8396,  8484,  8572,  8660,  8749,  8838,  8928,
+	 9017,  9107,  9197,  9288,  9379,  9470,  9561,  9652,  9744,  9836,  9929, 10021,
+	10114, 10207, 10300, 10393, 10487, 10581, 10675, 10770, 10864, 10959, 11054, 11149,
+	11244, 11340, 11436, 11532, 11628, 11724, 11820, 11917, 12014, 12111, 12208, 12305,
+	12403, 12500, 12598, 12696, 12794, 12892, 12990, 13089, 13187, 13286, 13385, 13484,
+	13583, 13682, 13781, 13880, 13980, 14079, 14179, 14278, 14378, 14478, 14578, 14678,
+	14778, 14878, 14978, 15078, 15178, 15279, 15379, 15479, 15580, 15680, 15780, 15881,
+	15981, 16082, 16182, 16283, 16383, 16484, 16585, 16685, 16786, 16886, 16987, 17087,
+	17187, 17288, 17388, 17488, 17589, 17689, 17789, 17889, 17989, 18089, 18189, 18289,
+	18389, 18489, 18588, 18688, 18787, 18887, 18986, 19085, 19184, 19283, 19382, 19481,
+	19580, 19678, 19777, 19875, 19973, 20071, 20169, 20267, 20364, 20462, 20559, 20656,
+	20753, 20850, 20947, 21043, 21139, 21235, 21331, 21427, 21523, 21618, 21713, 21808,
+	21903, 21997, 22092, 22186, 22280, 22374, 22467, 22560, 22653, 22746, 22838, 22931,
+	23023, 23115, 23206, 23297, 23388, 23479, 23570, 23660, 23750, 23839, 23929, 24018,
+	24107, 24195, 24283, 24371, 24459, 24546, 24633, 24720, 24806, 24892, 24978, 25064,
+	25149, 25233, 25318, 25402, 25486, 25569, 25652, 25735, 25817, 25899, 25981, 26062,
+	26143, 26224, 26304, 26384, 26463, 26542, 26621, 26699, 26777, 26855, 26932, 27008,
+	27085, 27161, 27236, 27311, 27386, 27460, 27534, 27608, 27681, 27753, 27825, 27897,
+	27968, 28039, 28110, 28180, 28249, 28318, 28387, 28455, 28523, 28590, 28657, 28723,
+	28789, 28855, 28920, 28984, 29048, 29112, 29175, 29237, 29299, 29361, 29422, 29483,
+	29543, 29602, 29662, 29720, 29778, 29836, 29893, 29950, 30006, 30061, 30117, 30171,
+	30225, 30279, 30332, 30384, 30436, 30488, 30538, 30589, 30639, 30688, 30737, 30785,
+	30832, 30880, 30926, 30972, 31018, 31063, 31107, 31151, 31194, 31237, 31279, 31320,
+	31361, 31402, 31442, 31481, 31520, 31558, 31596, 31633, 31669, 31705, 31740, 31775,
+	31809, 31843, 31876, 31908, 31940, 31971, 32002, 32032, 32062, 32090, 32119, 32146,
+	32174, 32200, 32226, 32251, 32276, 32300, 32324, 32347, 32369, 32391, 32412, 32432,
+	32452, 32472, 32490, 32508, 32526, 32543, 32559, 32575, 32590, 32604, 32618, 32631,
+	32644, 32656, 32667, 32678, 32688, 32698, 32707, 32715, 32723, 32730, 32736, 32742,
+	32747, 32752, 32756, 32759, 32762, 32764, 32766, 32767, 32767,
+};
+
+static const int16_t spectrum_window_blackmanharris[SPECTRUM_MAX_SIZE / 2 + 1] = {
+	    2,     2,     2,     2,     2,     2,     3,     3,     3,     3,     4,     4,
+	    5,     5,     5,     6,     7,     7,     8,     8,     9,    10,    11,    12,
+	   13,    13,    14,    16,    17,    18,    19,    20,    22,    23,    24,    26,
+	   27,    29,    30,    32,    34,    36,    38,    40,    42,    44,    46,    48,
+	   51,    53,    56,    58,    61,    64,    66,    69,    72,    76,    79,    82,
+	   85,    89,    93,    96,   100,   104,   108,   112,   117,   121,   126,   131,
+	  135,   140,   145,   151,   156,   162,   167,   173,   179,   185,   191,   198,
+	  204,   211,   218,   225,   233,   240,   248,   256,   264,   272,   281,   289,
+	  298,   307,   316,   326,   336,   346,   356,   366,   377,   388,   399,   410,
+	  422,   434,   446,   458,   471,   484,   497,   510,   524,   538,   552,   567,
+	  582,   597,   613,   628,   644,   661,   678,   695,   712,   730,   748,   767,
+	  785,   804,   824,   844,   864,   885,   906,   927,   949,   971,   993,  1016,
+	 1039,  1063,  1087,  1112,  1137,  1162,  1188,  1214,  1241,  1268,  1295,  1323,
+	 1352,  1381,  1410,  1440,  1470,  1501,  1532,  1564,  1596,  1629,  1662,  1695,
+	 1730,  1764,  1800,  1835,  1872,  1908,  1946,  1983,  2022,  2061,  2100,  2140,
+	 2181,  2222,  2264,  2306,  2349,  2392,  2436,  2481,  2526,  2572,  2618,  2665,
+	 2712,  2761,  2809,  2859,  2909,  2959,  3010,  3062,  3115,  3168,  3222,  3276,
+	 3331,  3387,  3443,  3500,  3557,  3616,  3675,  3734,  3794,  3855,  3917,  3979,
+	 4042,  4105,  4170,  4235,  4300,  4366,  4433,  4501,  4569,  4638,  4708,  4779,
+	 4850,  4922,  4994,  5067,  5141,  5216,  5291,  5367,  5444,  5521,  5599,  5678,
+	 5758,  5838,  5919,  6000,  6083,  6166,  6250,  6334,  6419,  6505,  6592,  6679,
+	 6767,  6856,  6945,  7035,  7126,  7217,  7309,  7402,  7496,  7590,  7685,  7781,
+	 7877,  7974,  8072,  8170,  8269,  8369,  8469,  8570,  8672,  8774,  8877,  8981,
+	 9085,  9190,  9296,  9402,  9509,  9617,  9725,  9834,  9943, 10053, 10164, 10275,
+	10387, 10499, 10613, 10726, 10840, 10955, 11071, 11187, 11303, 11420, 11538, 11656,
+	11775, 11894, 12014, 12134, 12255, 12376, 12498, 12620, 12743, 12866, 12990, 13114,
+	13239, 13364, 13489, 13615, 13741, 13868, 13995, 14123, 14251, 14379, 14508, 14637,
+	14767, 14896, 15027, 15157, 15288, 15419, 15550, 15682, 15814, 15946, 16079, 16212,
+	16345, 16478, 16611, 16745, 16879, 17013, 17147, 17282, 17416, 17551, 17686, 17821,
+	17956, 18091, 18226, 18362, 18497, 18633, 18768, 18904, 19040, 19175, 19311, 19446,
+	19582, 19718, 19853, 19989, 20124, 20259, 20395, 20530, 20665, 20800, 20934, 21069,
+	21203, 21337, 21471, 21605, 21739, 21872, 22005, 22138, 22271, 22403, 22535, 22667,
+	22798, 22929, 23060, 23190, 23320, 23450, 23579, 23708, 23836, 23964, 24091, 24218,
+	24345, 24471, 24596, 24721, 24846, 24970, 25093, 25216, 25338, 25460, 25581, 25701,
+	25821, 25940, 26059, 26177, 26294, 26410, 26526, 26641, 26755, 26869, 26982, 27094,
+	27205, 27316, 27425, 27534, 27642, 27749, 27856, 27961, 28066, 28169, 28272, 28374,
+	28475, 28575, 28674, 28772, 28870, 28966, 29061, 29155, 29249, 29341, 29432, 29522,
+	29611, 29699, 29786, 29872, 29957, 30041, 30123, 30205, 30285, 30364, 30442, 30519,
+	30595, 30670, 30743, 30815, 30886, 30956, 31024, 31092, 31158, 31223, 31286, 31349,
+	31410, 31470, 31528, 31586, 31642, 31696, 31750, 31802, 31853, 31902, 31950, 31997,
+	32043, 32087, 32130, 32171, 32211, 32250, 32287, 32323, 32358, 32391, 32423, 32453,
+	32482, 32510, 32536, 32561, 32585, 32607, 32627, 32646, 32664, 32681, 32696, 32709,
+	32721, 32732, 32741, 32749, 32756, 32761, 32764, 32766, 32767,
+};
+
+static const int16_t spectrum_window_kaiser[SPECTRUM_MAX_SIZE / 2 + 1] = {
+	   77,    81,    86,    92,    97,   102,   108,   114,   120,   126,   132,   138,
+	  145,   152,   158,   166,   173,   180,   188,   196,   204,   212,   220,   229,
+	  237,   246,   255,   265,   274,   284,   294,   304,   315,   325,   336,   347,
+	  358,   370,   382,   394,   406,   418,   431,   444,   457,   470,   484,   498,
+	  512,   527,   541,   556,   572,   587,   603,   619,   635,   652,   669,   686,
+	  704,   721,   739,   758,   776,   795,   815,   834,   854,   874,   895,   916,
+	  937,   958,   980,  1002,  1025,  1048,  1071,  1094,  1118,  1142,  1167,  1192,
+	 1217,  1242,  1268,  1295,  1321,  1348,  1376,  1404,  1432,  1460,  1489,  1518,
+	 1548,  1578,  1608,  1639,  1670,  1702,  1734,  1766,  1799,  1832,  1866,  1900,
+	 1934,  1969,  2004,  2040,  2076,  2112,  2149,  2187,  2224,  2263,  2301,  2340,
+	 2380,  2420,  2460,  2501,  2542,  2583,  2626,  2668,  2711,  2755,  2798,  2843,
+	 2888,  2933,  2979,  3025,  3071,  3118,  3166,  3214,  3263,  3311,  3361,  3411,
+	 3461,  3512,  3563,  3615,  3667,  3720,  3773,  3827,  3881,  3936,  3991,  4046,
+	 4103,  4159,  4216,  4274,  4332,  4390,  4449,  4509,  4569,  4629,  4690,  4752,
+	 4813,  4876,  4939,  5002,  5066,  5130,  5195,  5261,  5326,  5393,  5460,  5527,
+	 5595,  5663,  5732,  5801,  5871,  5941,  6012,  6083,  6155,  6227,  6299,  6373,
+	 6446,  6520,  6595,  6670,  6745,  6821,  6898,  6975,  7052,  7130,  7209,  7288,
+	 7367,  7447,  7527,  7608,  7689,  7771,  7853,  7935,  8018,  8102,  8186,  8270,
+	 8355,  8441,  8526,  8612,  8699,  8786,  8874,  8962,  9050,  9139,  9228,  9318,
+	 9408,  9498,  9589,  9681,  9772,  9865,  9957, 10050, 10143, 10237, 10331, 10426,
+	10521, 10616, 10712, 10808, 10905, 11001, 11099, 11196, 11294, 11392, 11491, 11590,
+	11689, 11789, 11889, 11989, 12090, 12191, 12292, 12394, 12496, 12598, 12701, 12804,
+	12907, 13011, 13114, 13218, 13323, 13427, 13532, 13637, 13743, 13849, 13954, 14061,
+	14167, 14274, 14381, 14488, 14595, 14703, 14810, 14918, 15027, 15135, 15244, 15352,
+	15461, 15570, 15680, 15789, 15899, 16008, 16118, 16228, 16339, 16449, 16559, 16670,
+	16781, 16892, 17002, 17113, 17225, 17336, 17447, 17558, 17670, 17781, 17893, 18004,
+	18116, 18228, 18339, 18451, 18563, 18674, 18786, 18898, 19010, 19121, 19233, 19345,
+	19456, 19568, 19680, 19791, 19902, 20014, 20125, 20236, 20348, 20459, 20570, 20680,
+	20791, 20902, 21012, 21123, 21233, 21343, 21453, 21563, 21672, 21782, 21891, 22000,
+	22109, 22218, 22326, 22435, 22543, 22651, 22758, 22866, 22973, 23080, 23186, 23293,
+	23399, 23504, 23610, 23715, 23820, 23925, 24029, 24133, 24237, 24340, 24443, 24546,
+	24648, 24750, 24851, 24952, 25053, 25154, 25254, 25353, 25452, 25551, 25650, 25748,
+	25845, 25942, 26039, 26135, 26231, 26326, 26421, 26515, 26609, 26702, 26795, 26887,
+	26979, 27070, 27161, 27251, 27341, 27430, 27518, 27607, 27694, 27781, 27867, 27953,
+	28038, 28123, 28207, 28290, 28373, 28455, 28536, 28617, 28698, 28777, 28856, 28935,
+	29012, 29089, 29166, 29241, 29316, 29391, 29464, 29537, 29609, 29681, 29752, 29822,
+	29891, 29960, 30028, 30095, 30162, 30227, 30292, 30357, 30420, 30483, 30545, 30606,
+	30666, 30726, 30785, 30843, 30900, 30956, 31012, 31067, 31121, 31174, 31227, 31278,
+	31329, 31379, 31428, 31476, 31524, 31570, 31616, 31661, 31705, 31748, 31791, 31832,
+	31873, 31912, 31951, 31989, 32026, 32062, 32098, 32132, 32166, 32199, 32230, 32261,
+	32291, 32320, 32349, 32376, 32402, 32428, 32452, 32476, 32499, 32520, 32541, 32561,
+	32580, 32599, 32616, 32632, 32647, 32662, 32675, 32688, 32700, 32710, 32720, 32729,
+	32737, 32744, 32750, 32755, 32760, 32763, 32765, 32767, 32767,
+};
+
+void AudioAnalyzeSpectrum::update(void)
+{
+	audio_block_t *block;
+
+	block = receiveReadOnly(0);
+	if (!block) return;
+	if (config_req) {
+		config_req = false;
+		size = req_size;
+		hop = req_hop;
+		output = req_output;
+		window_type = req_window;
+		switch (req_window) {
+		case SPECTRUM_WINDOW_BLACKMAN_HARRIS:
+			window_half = spectrum_window_blackmanharris;
+			break;
+		case SPECTRUM_WINDOW_KAISER:
+			window_half = spectrum_window_kaiser;
+			break;
+		default:
+			window_half = spectrum_window_hann;
+		}
+		window_step = SPECTRUM_MAX_SIZE / size;
+		// radix 4 is faster but only handles powers of 4
+		radix4 = (size == 256 || size == 1024);
+		if (radix4) arm_cfft_radix4_init_q15(&fft4_inst, size, 0, 1);
+		else arm_cfft_radix2_init_q15(&fft2_inst, size, 0, 1);
+		ring_pos = 0;
+		ring_filled = 0;
+		hop_count = 0;
+	}
+	if (size == 0 || output == NULL) {
+		sample_count += AUDIO_BLOCK_SAMPLES;
+		release(block);
+		return;
+	}
+	bool open = true;
+	if (gate_on) {
+		open = gateBlock(block->data) || keep_open;
+	} else {
+		gate_waking = false;
+	}
+	gate_open = open;
+	if (gate_reset_req) {
+		gate_reset_req = false;
+		gate_blocks = 0;
+		gate_open_blocks = 0;
+	}
+	gate_blocks++;
+	if (open) gate_open_blocks++;
+
+	int mask = size - 1;
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		ring[ring_pos] = block->data[i];
+		ring_pos = (ring_pos + 1) & mask;
+		if (ring_filled < size) ring_filled++;
+		if (++hop_count >= hop) {
+			hop_count = 0;
+			if (ring_filled >= size && open) {
+				if (gate_waking) {
+					gate_waking = false;
+					gate_latency = sample_count + i + 1 - gate_open_sample;
+				}
+				analyze(sample_count + i + 1 - size / 2);
+			}
+		}
+	}
+	sample_count += AUDIO_BLOCK_SAMPLES;
+	release(block);
+}
+
+void AudioAnalyzeSpectrum::analyze(uint32_t sample)
+{
+	int mask = size - 1;
+	int half = size / 2;
+	// oldest sample first, windowed; the window mirrors around its centre
+	for (int n = 0; n < size; n++) {
+		int w = (n <= half) ? window_half[n * window_step] :
+			window_half[(size - n) * window_step];
+		buffer[n * 2] = (ring[(ring_pos + n) & mask] * w) >> 15;
+		buffer[n * 2 + 1] = 0;
+	}
+	if (radix4) arm_cfft_radix4_q15(&fft4_inst, buffer);
+	else arm_cfft_radix2_q15(&fft2_inst, buffer);
+	for (int k = 0; k < half; k++) {
+		int32_t re = buffer[k * 2];
+		int32_t im = buffer[k * 2 + 1];
+		output[k] = sqrt_uint32_approx((uint32_t)(re * re) + (uint32_t)(im * im));
+	}
+	analyzed(output, sample);
+	outputflag = true;
+}
+
+// runs the gate band-pass over one block, true when its frames are wanted
+bool AudioAnalyzeSpectrum::gateBlock(const int16_t *data)
+{
+	if (gate_req) {
+		gate_req = false;
+		// RBJ band-pass with 0 dB at the geometric centre of the band
+		float fc = sqrtf(gate_lo * gate_hi);
+		if (fc > sample_rate * 0.45) fc = sample_rate * 0.45;
+		float w0 = 2.0 * 3.14159265 * fc / sample_rate;
+		float alpha = sinf(w0) * (gate_hi - gate_lo) / (2.0 * fc);
+		float a0 = 1.0 + alpha;
+		gate_b0 = alpha / a0 * 1073741824.0;
+		gate_a1 = -2.0 * cosf(w0) / a0 * 1073741824.0;
+		gate_a2 = (1.0 - alpha) / a0 * 1073741824.0;
+		gate_x1 = gate_x2 = gate_y1 = gate_y2 = 0;
+		gate_background = 0;
+		gate_hold_blocks = gate_hold_ms * sample_rate / (1000.0 * AUDIO_BLOCK_SAMPLES) + 0.5;
+		gate_hold_count = 0;
+	}
+
+	int32_t x1 = gate_x1, x2 = gate_x2, y1 = gate_y1, y2 = gate_y2;
+	uint32_t sum = 0;
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		int32_t x = data[i];
+		int64_t acc = (int64_t)gate_b0 * (x - x2) - (int64_t)gate_a1 * y1 - (int64_t)gate_a2 * y2;
+		int32_t y = acc >> 30;
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		sum += abs(y);
+	}
+	gate_x1 = x1;
+	gate_x2 = x2;
+	gate_y1 = y1;
+	gate_y2 = y2;
+
+	// the background steps down quickly and creeps up, calls hardly move it
+	uint32_t level = sum * 256 / AUDIO_BLOCK_SAMPLES;
+	if (gate_background == 0) gate_background = level + 1;
+	bool loud = (uint64_t)level * 256 > (uint64_t)gate_background * gate_ratio;
+	if (level > gate_background) gate_background += ((level - gate_background) >> 8) + 1;
+	else gate_background -= (gate_background - level) >> 3;
+
+	bool was_open = gate_hold_count > 0;
+	if (loud) gate_hold_count = gate_hold_blocks + 1;
+	else if (gate_hold_count > 0) gate_hold_count--;
+	if (gate_hold_count > 0 && !was_open) {
+		gate_waking = true;
+		gate_open_sample = sample_count;
+	}
+	return gate_hold_count > 0;
+}
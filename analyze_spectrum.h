@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef analyze_spectrum_h_
+#define analyze_spectrum_h_
+
+#include "AudioStream.h"
+#include "arm_math.h"
+
+#define SPECTRUM_MAX_SIZE        1024
+
+#define SPECTRUM_WINDOW_HANN            0
+#define SPECTRUM_WINDOW_BLACKMAN_HARRIS 1  // 4 term, low leakage
+#define SPECTRUM_WINDOW_KAISER          2  // beta 8
+
+// FFT analyzer of 128, 256, 512 or 1024 points with 0, 50 or 75% overlap.
+// The magnitudes of bins 0 .. size/2-1 are written into a buffer owned by
+// the caller every time a frame completes, scaled like AudioAnalyzeFFT256.
+// Windows come from half tables of the 1024 point windows in flash, the
+// smaller sizes step through them. A frame that completes while the
+// previous one was not read yet replaces it, e.g. 128 points at 75% overlap
+// computes 4 frames per block of which the sketch only sees the last.
+// An optional time domain gate saves the FFT work while the band of interest
+// is quiet: a biquad band-pass whose mean level per block is compared with
+// its own slowly rising background. Frames are only computed while a block
+// is loud and for a hold time after it. The input keeps going through the
+// ring, so the first frame after waking up already holds the onset.
+class AudioAnalyzeSpectrum : public AudioStream
+{
+public:
+	AudioAnalyzeSpectrum(void): AudioStream(1, inputQueueArray) {
+		size = 0;
+		window_type = SPECTRUM_WINDOW_HANN;
+		hop = 0;
+		output = NULL;
+		sample_count = 0;
+		config_req = false;
+		outputflag = false;
+		sample_rate = AUDIO_SAMPLE_RATE_EXACT;
+		gate_on = false;
+		gate_req = false;
+		gate_lo = 25000;
+		gate_hi = 100000;
+		gate_ratio = 3 * 256;
+		gate_hold_ms = 200;
+		gate_reset_req = false;
+		keep_open = false;
+		gate_open = true;
+		gate_blocks = 0;
+		gate_open_blocks = 0;
+		gate_latency = 0;
+	}
+	// output must hold size/2 values; the new setup starts at the next
+	// update() and the first frame follows after size samples
+	void configure(int points, int overlap, int window, uint16_t *buffer) {
+		if (points != 128 && points != 512 && points != 1024) points = 256;
+		req_size = points;
+		if (overlap >= 75) req_hop = points / 4;
+		else if (overlap >= 50) req_hop = points / 2;
+		else req_hop = points;
+		if (window < SPECTRUM_WINDOW_HANN || window > SPECTRUM_WINDOW_KAISER) window = SPECTRUM_WINDOW_HANN;
+		req_window = window;
+		req_output = buffer;
+		__sync_synchronize(); // settings before the request
+		config_req = true;
+	}
+	bool available() {
+		if (outputflag == true) {
+			outputflag = false;
+			return true;
+		}
+		return false;
+	}
+	// number of bins written per frame, 0 until configured
+	int bins(void) { return size / 2; }
+	// the rate the codec really runs at, for the gate filter
+	void setSampleRate(float rate) {
+		if (rate < 1.0) return;
+		sample_rate = rate;
+		gate_req = true;
+	}
+	float sampleRate(void) { return sample_rate; }
+	// compute frames only while lo to hi Hz carries ratio times its
+	// background level, and for hold ms after that
+	void gate(float lo, float hi, float ratio, float hold) {
+		if (lo < 1.0) lo = 1.0;
+		if (hi < lo * 1.1) hi = lo * 1.1;
+		if (ratio < 1.0) ratio = 1.0;
+		else if (ratio > 255.0) ratio = 255.0;
+		if (hold < 0.0) hold = 0.0;
+		gate_lo = lo;
+		gate_hi = hi;
+		gate_ratio = ratio * 256.0 + 0.5;
+		gate_hold_ms = hold;
+		__sync_synchronize(); // settings before the request
+		gate_req = true;
+		gate_on = true;
+	}
+	void gateOff(void) { gate_on = false; }
+	bool gateOpen(void) { return gate_open; }
+	// blocks with the gate open since the last reset, in percent
+	float gateDuty(void) {
+		if (gate_blocks == 0) return 100.0;
+		return gate_open_blocks * 100.0 / gate_blocks;
+	}
+	// starts counting again at the next update()
+	void gateDutyReset(void) { gate_reset_req = true; }
+	// samples from the start of the block that opened the gate to the end
+	// of the first frame computed after it, at the last wake up
+	uint32_t gateLatency(void) { return gate_latency; }
+	virtual void update(void);
+protected:
+	// called from update() with the magnitudes of every frame, sample is
+	// the input sample count at the centre of the frame
+	virtual void analyzed(const uint16_t *bins, uint32_t sample) { }
+	// complex FFT of the frame passed to analyzed(), real and imaginary
+	// interleaved
+	const int16_t *complexBins(void) { return buffer; }
+	int size;
+	int hop;
+	int window_type;
+	float sample_rate;
+	// frames are computed whatever the gate says, e.g. while a subclass
+	// is learning the background
+	volatile bool keep_open;
+private:
+	void analyze(uint32_t sample);
+	bool gateBlock(const int16_t *data);
+	audio_block_t *inputQueueArray[1];
+	volatile bool config_req;
+	int req_size;
+	int req_hop;
+	int req_window;
+	uint16_t *req_output;
+	volatile bool outputflag;
+	// running setup, only changed in update()
+	const int16_t *window_half;
+	int window_step;
+	uint16_t *output;
+	bool radix4;
+	int16_t ring[SPECTRUM_MAX_SIZE];
+	int ring_pos;
+	int ring_filled;
+	int hop_count;
+	uint32_t sample_count; // input samples since the start, wraps around
+	int16_t buffer[SPECTRUM_MAX_SIZE * 2] __attribute__ ((aligned (4)));
+	arm_cfft_radix4_instance_q15 fft4_inst;
+	arm_cfft_radix2_instance_q15 fft2_inst;
+	// gate settings, applied in update()
+	volatile bool gate_on;
+	volatile bool gate_req;
+	float gate_lo;
+	float gate_hi;
+	volatile uint32_t gate_ratio; // Q8
+	float gate_hold_ms;
+	// gate state
+	int32_t gate_b0;    // Q30, b1 is 0 and b2 is -b0
+	int32_t gate_a1;
+	int32_t gate_a2;
+	int32_t gate_x1;
+	int32_t gate_x2;
+	int32_t gate_y1;
+	int32_t gate_y2;
+	uint32_t gate_background; // mean absolute level per block, Q8
+	int gate_hold_blocks;
+	int gate_hold_count;
+	bool gate_waking;
+	uint32_t gate_open_sample;
+	volatile bool gate_open;
+	volatile bool gate_reset_req;
+	volatile uint32_t gate_blocks;
+	volatile uint32_t gate_open_blocks;
+	volatile uint32_t gate_latency;
+};
+
+#endif
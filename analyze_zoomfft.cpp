@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "analyze_zoomfft.h"
+#include "utility/sqrt_integer.h"
+#include "nco_sine.h"
+
+extern "C" {
+extern const int16_t AudioWindowHanning256[];
+}
+
+// Kaiser (beta 6) windowed sinc low-pass filters, cut off at 0.45 of the
+// decimated rate, Q15 with a DC gain of 1. Down 0.11 to 0.13 dB at 0.35
+// and at least 64 dB from 0.6 of the decimated rate, whose aliases land
+// beyond 0.4.
+static const int16_t zoom_taps2[32] = {
+	     1,     26,     13,    -88,    -81,    182,    269,   -264,
+	  -652,    227,   1325,    144,  -2516,  -1486,   5777,  13507,
+	 13507,   5777,  -1486,  -2516,    144,   1325,    227,   -652,
+	  -264,    269,    182,    -81,    -88,     13,     26,      1,
+};
+
+static const int16_t zoom_taps4[64] = {
+	    -1,      4,     12,     18,     14,     -4,    -34,    -59,
+	   -58,    -18,     56,    130,    157,     98,    -47,   -222,
+	  -333,   -287,    -54,    296,    599,    660,    356,   -272,
+	  -988,  -1416,  -1183,    -86,   1783,   4021,   6028,   7213,
+	  7215,   6028,   4021,   1783,    -86,  -1183,  -1416,   -988,
+	  -272,    356,    660,    599,    296,    -54,   -287,   -333,
+	  -222,    -47,     98,    157,    130,     56,    -18,    -58,
+	   -59,    -34,     -4,     14,     18,     12,      4,     -1,
+};
+
+static const int16_t zoom_taps8[128] = {
+	    -1,      0,      1,      3,      5,      7,      9,     10,
+	     9,      6,      1,     -6,    -14,    -21,    -28,    -32,
+	   -32,    -27,    -16,     -1,     18,     39,     58,     73,
+	    80,     77,     62,     35,     -2,    -46,    -91,   -132,
+	  -160,   -171,   -160,   -124,    -64,     14,    104,    193,
+	   271,    324,    340,    312,    235,    112,    -47,   -229,
+	  -411,   -570,   -680,   -717,   -660,   -497,   -221,    160,
+	   631,   1165,   1729,   2285,   2791,   3210,   3510,   3665,
+	  3665,   3510,   3210,   2791,   2285,   1729,   1165,    631,
+	   160,   -221,   -497,   -660,   -717,   -680,   -570,   -411,
+	  -229,    -47,    112,    235,    312,    340,    324,    271,
+	   193,    104,     14,    -64,   -124,   -160,   -171,   -160,
+	  -132,    -91,    -46,     -2,     35,     62,     77,     80,
+	    73,     58,     39,     18,     -1,    -16,    -27,    -32,
+	   -32,    -28,    -21,    -14,     -6,      1,      6,      9,
+	    10,      9,      7,      5,      3,      1,      0,     -1,
+};
+
+void AudioAnalyzeZoomFFT::reset(void)
+{
+	phase_accumulator = 0;
+	factor_count = 0;
+	history_pos = 0;
+	memset(history_i, 0, sizeof(history_i));
+	memset(history_q, 0, sizeof(history_q));
+	zoom_pos = 0;
+	zoom_count = 0;
+	zoom_filled = false;
+}
+
+void AudioAnalyzeZoomFFT::update(void)
+{
+	audio_block_t *block;
+
+	block = receiveReadOnly(0);
+	if (!block) return;
+	if (band_req) {
+		band_req = false;
+		phase_increment = req_increment;
+		factor = req_decimate;
+		switch (factor) {
+		case 2: taps = zoom_taps2; break;
+		case 4: taps = zoom_taps4; break;
+		default: taps = zoom_taps8;
+		}
+		ntaps = ZOOMFFT_TAPS_PER_PHASE * factor;
+		reset();
+	}
+	if (factor == 0) {
+		release(block);
+		return;
+	}
+
+	uint32_t ph = phase_accumulator;
+	uint32_t inc = phase_increment;
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		// multiply by e^(-j w n), the centre frequency moves to 0 Hz
+		int32_t x = block->data[i];
+		int16_t si = (x * nco_sine(ph + 0x40000000)) >> 15;
+		int16_t sq = -((x * nco_sine(ph)) >> 15);
+		ph += inc;
+		history_i[history_pos] = si;
+		history_i[history_pos + ntaps] = si;
+		history_q[history_pos] = sq;
+		history_q[history_pos + ntaps] = sq;
+		if (++history_pos >= ntaps) history_pos = 0;
+
+		// polyphase decimation: the FIR only runs for the samples kept
+		if (++factor_count < factor) continue;
+		factor_count = 0;
+		const int16_t *hi = history_i + history_pos;
+		const int16_t *hq = history_q + history_pos;
+		int32_t acc_i = 0, acc_q = 0;
+		for (int k = 0; k < ntaps; k++) {
+			acc_i += taps[k] * hi[k];
+			acc_q += taps[k] * hq[k];
+		}
+		zoom_ring[zoom_pos * 2] = acc_i >> 15;
+		zoom_ring[zoom_pos * 2 + 1] = acc_q >> 15;
+		zoom_pos = (zoom_pos + 1) & (ZOOMFFT_SIZE - 1);
+		if (zoom_pos == 0) zoom_filled = true;
+		// a new FFT every half frame
+		if (++zoom_count >= ZOOMFFT_SIZE / 2) {
+			zoom_count = 0;
+			if (zoom_filled) analyze();
+		}
+	}
+	phase_accumulator = ph;
+	release(block);
+}
+
+void AudioAnalyzeZoomFFT::analyze(void)
+{
+	// oldest sample first, windowed
+	for (int n = 0; n < ZOOMFFT_SIZE; n++) {
+		int idx = (zoom_pos + n) & (ZOOMFFT_SIZE - 1);
+		int32_t w = AudioWindowHanning256[n];
+		buffer[n * 2] = (zoom_ring[idx * 2] * w) >> 15;
+		buffer[n * 2 + 1] = (zoom_ring[idx * 2 + 1] * w) >> 15;
+	}
+	arm_cfft_radix4_q15(&fft_inst, buffer);
+	// negative frequencies first, output[ZOOMFFT_SIZE / 2] is the centre
+	for (int m = 0; m < ZOOMFFT_SIZE; m++) {
+		int k = (m + ZOOMFFT_SIZE / 2) & (ZOOMFFT_SIZE - 1);
+		int32_t re = buffer[k * 2];
+		int32_t im = buffer[k * 2 + 1];
+		output[m] = sqrt_uint32_approx((uint32_t)(re * re) + (uint32_t)(im * im));
+	}
+	outputflag = true;
+}
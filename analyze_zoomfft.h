@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef analyze_zoomfft_h_
+#define analyze_zoomfft_h_
+
+#include "AudioStream.h"
+#include "arm_math.h"
+
+#define ZOOMFFT_SIZE             256
+// FIR length per decimation step, the filter has 16 * decimation taps
+#define ZOOMFFT_TAPS_PER_PHASE   16
+#define ZOOMFFT_MAX_TAPS         (ZOOMFFT_TAPS_PER_PHASE * 8)
+
+// Zoom FFT: the input is mixed down to complex baseband around a centre
+// frequency, low-pass filtered and decimated by 2, 4 or 8 with a polyphase
+// FIR, and a 256 point complex FFT runs on the result with 50% overlap.
+// The 256 bins span sample rate / decimation, so they are decimation
+// times narrower than those of AudioAnalyzeFFT256 while there are
+// decimation times fewer FFTs per second.
+// output[128] is the centre frequency, output[0] the lowest. The FIR is
+// flat to 70% and alias free to 80% of the span, the outer bins are not.
+class AudioAnalyzeZoomFFT : public AudioStream
+{
+public:
+	AudioAnalyzeZoomFFT(void): AudioStream(1, inputQueueArray) {
+		sample_rate = AUDIO_SAMPLE_RATE_EXACT;
+		centre_freq = 0;
+		decimate = 0;
+		band_req = false;
+		outputflag = false;
+		phase_increment = 0;
+		factor = 0;
+		taps = NULL;
+		ntaps = 0;
+		arm_cfft_radix4_init_q15(&fft_inst, ZOOMFFT_SIZE, 0, 1);
+	}
+	bool available() {
+		if (outputflag == true) {
+			outputflag = false;
+			return true;
+		}
+		return false;
+	}
+	float read(unsigned int binNumber) {
+		if (binNumber >= ZOOMFFT_SIZE) return 0.0;
+		return (float)(output[binNumber]) * (1.0 / 16384.0);
+	}
+	// the rate the codec really runs at, AUDIO_SAMPLE_RATE_EXACT until set
+	void setSampleRate(float rate) {
+		if (rate < 1.0) return;
+		sample_rate = rate;
+		band(centre_freq, decimate);
+	}
+	// analyse centre -/+ sample rate / (2 * factor), factor 2, 4 or 8.
+	// A factor of 0 stops the analysis. Applied at the next update().
+	void band(float centre, int factor) {
+		if (factor != 0 && factor != 2 && factor != 4 && factor != 8) factor = 4;
+		if (centre < 0.0) centre = 0.0;
+		else if (centre > sample_rate / 2) centre = sample_rate / 2;
+		centre_freq = centre;
+		decimate = factor;
+		req_increment = centre / sample_rate * 4294967296.0 + 0.5;
+		req_decimate = factor;
+		band_req = true;
+	}
+	float binWidth(void) {
+		if (decimate == 0) return 0.0;
+		return sample_rate / (decimate * ZOOMFFT_SIZE);
+	}
+	// frequency at the centre of output[bin]
+	float binFrequency(int bin) {
+		return centre_freq + (bin - ZOOMFFT_SIZE / 2) * binWidth();
+	}
+	virtual void update(void);
+	uint16_t output[ZOOMFFT_SIZE] __attribute__ ((aligned (4)));
+private:
+	void reset(void);
+	void analyze(void);
+	audio_block_t *inputQueueArray[1];
+	float sample_rate;
+	float centre_freq;
+	int decimate;
+	volatile bool band_req;
+	uint32_t req_increment;
+	uint8_t req_decimate;
+	volatile bool outputflag;
+	// mixer and decimator, running in update()
+	uint32_t phase_accumulator;
+	uint32_t phase_increment;
+	uint8_t factor;
+	uint8_t factor_count;
+	const int16_t *taps;
+	int ntaps;
+	// I and Q histories, written twice so the newest ntaps are contiguous
+	int16_t history_i[ZOOMFFT_MAX_TAPS * 2];
+	int16_t history_q[ZOOMFFT_MAX_TAPS * 2];
+	int history_pos;
+	// decimated complex samples, interleaved I and Q, a ring
+	int16_t zoom_ring[ZOOMFFT_SIZE * 2];
+	int zoom_pos;
+	int zoom_count;
+	bool zoom_filled;
+	int16_t buffer[ZOOMFFT_SIZE * 2] __attribute__ ((aligned (4)));
+	arm_cfft_radix4_instance_q15 fft_inst;
+};
+
+#endif
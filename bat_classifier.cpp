@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "bat_classifier.h"
+
+struct batclass_rule {
+	uint8_t group;
+	float fchar_lo, fchar_hi;   // kHz
+	float dur_lo, dur_hi;       // ms
+	float bw_lo, bw_hi;         // kHz
+	float slope_lo, slope_hi;   // kHz/ms
+	float ipi_lo, ipi_hi;       // ms, an unknown interval always fits
+};
+
+// Most specific first; ranges from published call parameters, widened for
+// the FFT frame resolution of the detector.
+static const batclass_rule rules[] = {
+	// constant frequency calls, long and narrow
+	{ BATCLASS_RHINO_HIPPO,     104, 116,   15, 80,    0, 15,    -2, 2,      0, 1000 },
+	{ BATCLASS_RHINO_FERRUM,     77,  86,   25, 90,    0, 15,    -2, 2,      0, 1000 },
+	// steep, broadband FM
+	{ BATCLASS_MYOTIS,           25,  60,  1.5,  8,   35, 120,    6, 100,    0, 1000 },
+	// FM with a quasi constant frequency tail, told apart by where it ends
+	{ BATCLASS_PIP_PYGMAEUS,     51,  62,    3, 12,    0, 45,     0, 12,     0, 200 },
+	{ BATCLASS_PIP_PIPISTRELLUS, 42,  50,    3, 12,    0, 45,     0, 12,     0, 200 },
+	{ BATCLASS_PIP_NATHUSII,     34,  41,    4, 14,    0, 45,     0, 10,     0, 250 },
+	// low and long with long intervals
+	{ BATCLASS_NYCTALOID,        17,  33,    6, 30,    0, 40,     0, 5,    120, 1000 },
+};
+
+static const char *const group_names[BATCLASS_COUNT] = {
+	"?", "Nyc/Ept", "Myotis", "P.nat", "P.pip", "P.pyg", "R.fer", "R.hip"
+};
+
+static bool inside(float value, float lo, float hi)
+{
+	return value >= lo && value <= hi;
+}
+
+uint8_t BatCallClassifier::classify(const batcall_features &call, uint32_t now)
+{
+	uint8_t group = BATCLASS_UNKNOWN;
+	float fchar = call.fchar * 0.001;
+	float bandwidth = call.bandwidth * 0.001;
+
+	for (unsigned int n = 0; n < sizeof(rules) / sizeof(rules[0]); n++) {
+		const batclass_rule &r = rules[n];
+		if (inside(fchar, r.fchar_lo, r.fchar_hi) &&
+			inside(call.duration, r.dur_lo, r.dur_hi) &&
+			inside(bandwidth, r.bw_lo, r.bw_hi) &&
+			inside(call.slope, r.slope_lo, r.slope_hi) &&
+			(call.interval == 0.0 || inside(call.interval, r.ipi_lo, r.ipi_hi))) {
+			group = r.group;
+			break;
+		}
+	}
+
+	if (call_count[group] == 0 || now - last_call[group] > BATCLASS_PASS_GAP) {
+		pass_count[group]++;
+	}
+	call_count[group]++;
+	last_call[group] = now;
+	return group;
+}
+
+void BatCallClassifier::reset(void)
+{
+	for (int n = 0; n < BATCLASS_COUNT; n++) {
+		call_count[n] = 0;
+		pass_count[n] = 0;
+		last_call[n] = 0;
+	}
+}
+
+const char *BatCallClassifier::name(uint8_t group)
+{
+	if (group >= BATCLASS_COUNT) group = BATCLASS_UNKNOWN;
+	return group_names[group];
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef bat_classifier_h_
+#define bat_classifier_h_
+
+#include "analyze_batdetector.h"
+
+// species groups, 0 is a call that fits none of them
+#define BATCLASS_UNKNOWN         0
+#define BATCLASS_NYCTALOID       1  // Nyctalus, Eptesicus, Vespertilio
+#define BATCLASS_MYOTIS          2
+#define BATCLASS_PIP_NATHUSII    3  // also P. kuhlii
+#define BATCLASS_PIP_PIPISTRELLUS 4
+#define BATCLASS_PIP_PYGMAEUS    5
+#define BATCLASS_RHINO_FERRUM    6  // greater horseshoe
+#define BATCLASS_RHINO_HIPPO     7  // lesser horseshoe
+#define BATCLASS_COUNT           8
+
+// calls of one group further apart than this start a new pass, ms
+#define BATCLASS_PASS_GAP        2000
+
+// Rule based classifier of the calls found by AudioAnalyzeBatDetector,
+// for European species. The rules are a table in flash, tried in order;
+// the first one whose ranges hold all parameters of the call decides.
+// Calls and passes are counted per group; a pass starts with the first
+// call of a group after BATCLASS_PASS_GAP without one.
+class BatCallClassifier
+{
+public:
+	BatCallClassifier(void) { reset(); }
+	// group of a call that ended at now (millis()), counted in its totals
+	uint8_t classify(const batcall_features &call, uint32_t now);
+	uint32_t calls(uint8_t group) {
+		if (group >= BATCLASS_COUNT) return 0;
+		return call_count[group];
+	}
+	uint32_t passes(uint8_t group) {
+		if (group >= BATCLASS_COUNT) return 0;
+		return pass_count[group];
+	}
+	void reset(void);
+	static const char *name(uint8_t group);
+private:
+	uint32_t call_count[BATCLASS_COUNT];
+	uint32_t pass_count[BATCLASS_COUNT];
+	uint32_t last_call[BATCLASS_COUNT]; // millis() of the last call
+};
+
+#endif
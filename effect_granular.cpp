@@ -24,9 +24,266 @@
 #include <Arduino.h>
 #include "effect_granular.h"
 
-void AudioEffectGranular::begin(int16_t *sample_bank_def, int16_t max_len_def)
+// 4-tap windowed sinc (Lanczos, a=2) in 32 fractional phases, Q15.
+// Taps apply to the samples at offsets -1, 0, +1 and +2 of the read position.
+static const int16_t te_fir_taps[32][4] = {
+	{     0,  32767,      0,      0},
+	{  -611,  32694,    693,     -8},
+	{ -1141,  32476,   1465,    -34},
+	{ -1591,  32118,   2317,    -78},
+	{ -1963,  31626,   3245,   -141},
+	{ -2260,  31005,   4245,   -223},
+	{ -2487,  30265,   5313,   -324},
+	{ -2648,  29414,   6445,   -444},
+	{ -2748,  28462,   7635,   -581},
+	{ -2793,  27418,   8876,   -734},
+	{ -2789,  26294,  10164,   -902},
+	{ -2740,  25099,  11490,  -1081},
+	{ -2654,  23844,  12847,  -1270},
+	{ -2536,  22540,  14228,  -1465},
+	{ -2392,  21197,  15625,  -1662},
+	{ -2228,  19824,  17029,  -1858},
+	{ -2048,  18431,  18431,  -2048},
+	{ -1858,  17029,  19824,  -2228},
+	{ -1662,  15625,  21197,  -2392},
+	{ -1465,  14228,  22540,  -2536},
+	{ -1270,  12847,  23844,  -2654},
+	{ -1081,  11490,  25099,  -2740},
+	{  -902,  10164,  26294,  -2789},
+	{  -734,   8876,  27418,  -2793},
+	{  -581,   7635,  28462,  -2748},
+	{  -444,   6445,  29414,  -2648},
+	{  -324,   5313,  30265,  -2487},
+	{  -223,   4245,  31005,  -2260},
+	{  -141,   3245,  31626,  -1963},
+	{   -78,   2317,  32118,  -1591},
+	{   -34,   1465,  32476,  -1141},
+	{    -8,    693,  32694,   -611},
+};
+
+// Overlap-add windows for grain_mode 5, 256 entries over one grain, Q15.
+// Periodic Hann, overlap-adds to grains/2.
+static const int16_t ola_window_hann[256] = {
+	     0,      5,     20,     44,     79,    123,    177,    241,    315,    398,    491,    593,
+	   705,    827,    958,   1098,   1247,   1406,   1573,   1749,   1935,   2128,   2331,   2542,
+	  2761,   2989,   3224,   3468,   3719,   3978,   4244,   4518,   4799,   5086,   5381,   5682,
+	  5990,   6304,   6624,   6950,   7281,   7618,   7961,   8308,   8660,   9017,   9379,   9744,
+	 10114,  10487,  10864,  11244,  11628,  12014,  12403,  12794,  13187,  13583,  13980,  14378,
+	 14778,  15178,  15580,  15981,  16383,  16786,  17187,  17589,  17989,  18389,  18787,  19184,
+	 19580,  19973,  20364,  20753,  21139,  21523,  21903,  22280,  22653,  23023,  23388,  23750,
+	 24107,  24459,  24806,  25149,  25486,  25817,  26143,  26463,  26777,  27085,  27386,  27681,
+	 27968,  28249,  28523,  28789,  29048,  29299,  29543,  29778,  30006,  30225,  30436,  30639,
+	 30832,  31018,  31194,  31361,  31520,  31669,  31809,  31940,  32062,  32174,  32276,  32369,
+	 32452,  32526,  32590,  32644,  32688,  32723,  32747,  32762,  32767,  32762,  32747,  32723,
+	 32688,  32644,  32590,  32526,  32452,  32369,  32276,  32174,  32062,  31940,  31809,  31669,
+	 31520,  31361,  31194,  31018,  30832,  30639,  30436,  30225,  30006,  29778,  29543,  29299,
+	 29048,  28789,  28523,  28249,  27968,  27681,  27386,  27085,  26777,  26463,  26143,  25817,
+	 25486,  25149,  24806,  24459,  24107,  23750,  23388,  23023,  22653,  22280,  21903,  21523,
+	 21139,  20753,  20364,  19973,  19580,  19184,  18787,  18389,  17989,  17589,  17187,  16786,
+	 16384,  15981,  15580,  15178,  14778,  14378,  13980,  13583,  13187,  12794,  12403,  12014,
+	 11628,  11244,  10864,  10487,  10114,   9744,   9379,   9017,   8660,   8308,   7961,   7618,
+	  7281,   6950,   6624,   6304,   5990,   5682,   5381,   5086,   4799,   4518,   4244,   3978,
+	  3719,   3468,   3224,   2989,   2761,   2542,   2331,   2128,   1935,   1749,   1573,   1406,
+	  1247,   1098,    958,    827,    705,    593,    491,    398,    315,    241,    177,    123,
+	    79,     44,     20,      5,
+};
+
+// Trapezoids with ramps as long as the spacing of 2, 3 and 4 grains, they
+// overlap-add to grains-1.
+static const int16_t ola_window_trapezoid[3][256] = {
+	{
+		     0,    256,    512,    768,   1024,   1280,   1536,   1792,   2048,   2304,   2560,   2816,
+		  3072,   3328,   3584,   3840,   4096,   4352,   4608,   4864,   5120,   5376,   5632,   5888,
+		  6144,   6400,   6656,   6912,   7168,   7424,   7680,   7936,   8192,   8448,   8704,   8960,
+		  9216,   9472,   9728,   9984,  10240,  10496,  10752,  11008,  11264,  11520,  11776,  12032,
+		 12288,  12544,  12800,  13056,  13312,  13568,  13824,  14080,  14336,  14592,  14848,  15104,
+		 15360,  15616,  15872,  16128,  16384,  16639,  16895,  17151,  17407,  17663,  17919,  18175,
+		 18431,  18687,  18943,  19199,  19455,  19711,  19967,  20223,  20479,  20735,  20991,  21247,
+		 21503,  21759,  22015,  22271,  22527,  22783,  23039,  23295,  23551,  23807,  24063,  24319,
+		 24575,  24831,  25087,  25343,  25599,  25855,  26111,  26367,  26623,  26879,  27135,  27391,
+		 27647,  27903,  28159,  28415,  28671,  28927,  29183,  29439,  29695,  29951,  30207,  30463,
+		 30719,  30975,  31231,  31487,  31743,  31999,  32255,  32511,  32767,  32511,  32255,  31999,
+		 31743,  31487,  31231,  30975,  30719,  30463,  30207,  29951,  29695,  29439,  29183,  28927,
+		 28671,  28415,  28159,  27903,  27647,  27391,  27135,  26879,  26623,  26367,  26111,  25855,
+		 25599,  25343,  25087,  24831,  24575,  24319,  24063,  23807,  23551,  23295,  23039,  22783,
+		 22527,  22271,  22015,  21759,  21503,  21247,  20991,  20735,  20479,  20223,  19967,  19711,
+		 19455,  19199,  18943,  18687,  18431,  18175,  17919,  17663,  17407,  17151,  16895,  16639,
+		 16384,  16128,  15872,  15616,  15360,  15104,  14848,  14592,  14336,  14080,  13824,  13568,
+		 13312,  13056,  12800,  12544,  12288,  12032,  11776,  11520,  11264,  11008,  10752,  10496,
+		 10240,   9984,   9728,   9472,   9216,   8960,   8704,   8448,   8192,   7936,   7680,   7424,
+		  7168,   6912,   6656,   6400,   6144,   5888,   5632,   5376,   5120,   4864,   4608,   4352,
+		  4096,   3840,   3584,   3328,   3072,   2816,   2560,   2304,   2048,   1792,   1536,   1280,
+		  1024,    768,    512,    256,
+	}, {
+		     0,    384,    768,   1152,   1536,   1920,   2304,   2688,   3072,   3456,   3840,   4224,
+		  4608,   4992,   5376,   5760,   6144,   6528,   6912,   7296,   7680,   8064,   8448,   8832,
+		  9216,   9600,   9984,  10368,  10752,  11136,  11520,  11904,  12288,  12672,  13056,  13440,
+		 13824,  14208,  14592,  14976,  15360,  15744,  16128,  16511,  16895,  17279,  17663,  18047,
+		 18431,  18815,  19199,  19583,  19967,  20351,  20735,  21119,  21503,  21887,  22271,  22655,
+		 23039,  23423,  23807,  24191,  24575,  24959,  25343,  25727,  26111,  26495,  26879,  27263,
+		 27647,  28031,  28415,  28799,  29183,  29567,  29951,  30335,  30719,  31103,  31487,  31871,
+		 32255,  32639,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32639,  32255,  31871,  31487,  31103,  30719,  30335,  29951,  29567,
+		 29183,  28799,  28415,  28031,  27647,  27263,  26879,  26495,  26111,  25727,  25343,  24959,
+		 24575,  24191,  23807,  23423,  23039,  22655,  22271,  21887,  21503,  21119,  20735,  20351,
+		 19967,  19583,  19199,  18815,  18431,  18047,  17663,  17279,  16895,  16511,  16128,  15744,
+		 15360,  14976,  14592,  14208,  13824,  13440,  13056,  12672,  12288,  11904,  11520,  11136,
+		 10752,  10368,   9984,   9600,   9216,   8832,   8448,   8064,   7680,   7296,   6912,   6528,
+		  6144,   5760,   5376,   4992,   4608,   4224,   3840,   3456,   3072,   2688,   2304,   1920,
+		  1536,   1152,    768,    384,
+	}, {
+		     0,    512,   1024,   1536,   2048,   2560,   3072,   3584,   4096,   4608,   5120,   5632,
+		  6144,   6656,   7168,   7680,   8192,   8704,   9216,   9728,  10240,  10752,  11264,  11776,
+		 12288,  12800,  13312,  13824,  14336,  14848,  15360,  15872,  16384,  16895,  17407,  17919,
+		 18431,  18943,  19455,  19967,  20479,  20991,  21503,  22015,  22527,  23039,  23551,  24063,
+		 24575,  25087,  25599,  26111,  26623,  27135,  27647,  28159,  28671,  29183,  29695,  30207,
+		 30719,  31231,  31743,  32255,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,  32767,
+		 32767,  32255,  31743,  31231,  30719,  30207,  29695,  29183,  28671,  28159,  27647,  27135,
+		 26623,  26111,  25599,  25087,  24575,  24063,  23551,  23039,  22527,  22015,  21503,  20991,
+		 20479,  19967,  19455,  18943,  18431,  17919,  17407,  16895,  16384,  15872,  15360,  14848,
+		 14336,  13824,  13312,  12800,  12288,  11776,  11264,  10752,  10240,   9728,   9216,   8704,
+		  8192,   7680,   7168,   6656,   6144,   5632,   5120,   4608,   4096,   3584,   3072,   2560,
+		  2048,   1536,   1024,    512,
+	}
+};
+
+// 1/overlap-add sum for 2, 3 and 4 grains, Q15
+static const int16_t ola_gain[2][3] = {
+	{ 32767, 21845, 16384 },	// Hann
+	{ 32767, 16384, 10923 },	// trapezoid
+};
+
+#if defined(__ARM_ARCH_7EM__)
+// Cortex-M4 DSP instructions
+static inline int16_t te_saturate(int32_t val)
+{
+	int32_t out;
+	asm volatile("ssat %0, #16, %1" : "=r" (out) : "r" (val));
+	return out;
+}
+
+// sum + a.bottom * b.bottom + a.top * b.top
+static inline int32_t te_dual_mac(int32_t sum, uint32_t a, uint32_t b)
+{
+	int32_t out;
+	asm volatile("smlad %0, %1, %2, %3" : "=r" (out) : "r" (a), "r" (b), "r" (sum));
+	return out;
+}
+#else
+// portable versions, so the kernels also build and run on a PC
+static inline int16_t te_saturate(int32_t val)
+{
+	if (val > 32767) return 32767;
+	if (val < -32768) return -32768;
+	return val;
+}
+
+static inline int32_t te_dual_mac(int32_t sum, uint32_t a, uint32_t b)
+{
+	return sum + (int16_t)a * (int16_t)b + (int16_t)(a >> 16) * (int16_t)(b >> 16);
+}
+#endif
+
+// two neighbouring samples packed in one word, p[0] in the bottom half.
+// The Cortex-M4 does this with a single unaligned load.
+static inline uint32_t te_pair(const int16_t *p)
+{
+	uint32_t pair;
+	memcpy(&pair, p, sizeof(pair));
+	return pair;
+}
+
+// Time expansion playback kernel, one instance per interpolation mode.
+// Renders up to len samples from bank, starting at the 16.16 position *acc
+// and advancing by rate, and stops early once the integer position reaches
+// limit.  The caller keeps the position at 1 or above and limit two samples
+// short of the recorded data, so the kernel may read bank[idx-1] to
+// bank[idx+2].  The return value is the number of samples written to out.
+template <int interp>
+static int te_kernel(const int16_t *bank, int16_t *out, int len,
+	uint32_t *acc, uint32_t rate, int32_t limit)
+{
+	uint32_t pos = *acc;
+
+	// work out up front how many samples fit before limit, so the loop
+	// itself has no exit test
+	if ((int32_t)(pos >> 16) >= limit) return 0;
+	uint32_t room = ((uint32_t)limit << 16) - pos;
+	uint32_t count = (room + rate - 1) / rate;
+	if (count < (uint32_t)len) len = count;
+
+	for (int n = 0; n < len; n++) {
+		const int16_t *p = bank + (pos >> 16);
+		int32_t t = (pos >> 1) & 0x7FFF;
+		if (interp == GRANULAR_INTERP_NONE) {
+			out[n] = p[0];
+		} else if (interp == GRANULAR_INTERP_LINEAR) {
+			int32_t x0 = p[0];
+			out[n] = x0 + (((p[1] - x0) * t) >> 15);
+		} else if (interp == GRANULAR_INTERP_HERMITE) {
+			int32_t xm1 = p[-1], x0 = p[0], x1 = p[1], x2 = p[2];
+			// Catmull-Rom coefficients, each scaled by 2
+			int32_t a = (x2 - xm1) + 3 * (x0 - x1);
+			int32_t b = 2 * xm1 - 5 * x0 + 4 * x1 - x2;
+			int32_t c = x1 - xm1;
+			int32_t v = (int32_t)(((int64_t)a * t) >> 15) + b;
+			v = (int32_t)(((int64_t)v * t) >> 15) + c;
+			v = (int32_t)(((int64_t)v * t) >> 16) + x0;
+			out[n] = te_saturate(v);
+		} else {
+			const int16_t *h = te_fir_taps[(pos >> 11) & 31];
+			int32_t sum = te_dual_mac(16384, te_pair(p - 1), te_pair(h));
+			sum = te_dual_mac(sum, te_pair(p + 1), te_pair(h + 2));
+			out[n] = te_saturate(sum >> 15);
+		}
+		pos += rate;
+	}
+	*acc = pos;
+	return len;
+}
+
+typedef int (*te_kernel_t)(const int16_t *bank, int16_t *out, int len,
+	uint32_t *acc, uint32_t rate, int32_t limit);
+
+static const te_kernel_t te_kernels[4] = {
+	te_kernel<GRANULAR_INTERP_NONE>,
+	te_kernel<GRANULAR_INTERP_LINEAR>,
+	te_kernel<GRANULAR_INTERP_HERMITE>,
+	te_kernel<GRANULAR_INTERP_FIR>,
+};
+
+void AudioEffectGranular::begin(int16_t *sample_bank_def, int32_t max_len_def)
 {
-	max_sample_len = max_len_def;
+	begin(&sample_bank_def, &max_len_def, 1);
+}
+
+void AudioEffectGranular::begin(int16_t **segments, const int32_t *lengths, int count)
+{
+	if (count < 1) count = 1;
+	else if (count > GRANULAR_MAX_SEGMENTS) count = GRANULAR_MAX_SEGMENTS;
+	segment_count = count;
+	segment_start[0] = 0;
+	for (int i = 0; i < count; i++) {
+		segment[i] = segments[i];
+		segment_start[i + 1] = segment_start[i] + lengths[i];
+	}
+	max_sample_len = segment_start[count];
 	grain_mode = 0;
 	read_head = 0;
 	write_head = 0;
@@ -35,86 +292,268 @@ void AudioEffectGranular::begin(int16_t *sample_bank_def, int16_t max_len_def)
 	accumulator = 0;
 	allow_len_change = true;
 	sample_loaded = false;
-	sample_bank = sample_bank_def;
-	int subsample=0;
+	sample_bank = segments[0];
+	interp_mode = GRANULAR_INTERP_LINEAR;
+	divider = 10;
+	divider_shape = GRANULAR_DIVIDER_SQUARE;
+	bank_count = 1;
+	bank_len = max_sample_len;
+	bank_first = 0;
+	bank_used = 0;
+	dropped_calls = 0;
+	pre_trigger = 0;
+	ola_grains = 4;
+	ola_window = GRANULAR_WINDOW_HANN;
+	sample_count = 0;
+	onset_noise = 0;
+	onset_blocks = 0;
+	onset_active = false;
+	trigger_latency = -1;
+}
+
+// pointer to sample pos of the whole bank, run is set to the number of
+// samples that follow it in the same segment
+int16_t *AudioEffectGranular::bankPtr(int32_t pos, int32_t *run)
+{
+	int s = 0;
+	while (s < segment_count - 1 && pos >= segment_start[s + 1]) s++;
+	*run = segment_start[s + 1] - pos;
+	return segment[s] + (pos - segment_start[s]);
+}
+
+// pointer to a sample of a time expansion bank, with offset counted from
+// the start of the bank's memory. run stops at the end of the bank too.
+int16_t *AudioEffectGranular::ringPtr(uint8_t bank, int32_t offset, int32_t *run)
+{
+	int16_t *p = bankPtr(bank * bank_len + offset, run);
+	if (*run > bank_len - offset) *run = bank_len - offset;
+	return p;
+}
+
+// Time expansion playback of a bank.  read_head is the integer and
+// accumulator the 16-bit fractional read position, counted from the first
+// sample of the recording, which may sit anywhere in the bank's ring.  The
+// kernels run in place on each stretch of memory; only where their 4 taps
+// straddle the ring or a segment edge are a few samples gathered first.
+int AudioEffectGranular::renderBank(uint8_t bank, int16_t *out, int len, int32_t limit)
+{
+	te_kernel_t kernel = te_kernels[interp_mode];
+	int n = 0;
+
+	while (n < len && read_head < limit) {
+		int16_t taps[8];
+		int32_t run;
+		int32_t offset = bank_start[bank] + read_head - 1;
+		if (offset >= bank_len) offset -= bank_len;
+		const int16_t *p = ringPtr(bank, offset, &run);
+		// the kernels read p[0] to p[idx+2] for a local position idx >= 1
+		int32_t local_limit = run - 2;
+		if (local_limit < 2) {
+			int32_t avail = limit + 3 - read_head;
+			if (avail > 8) avail = 8;
+			for (int i = 0; i < avail; i++) {
+				int32_t r;
+				taps[i] = *ringPtr(bank, offset, &r);
+				if (++offset >= bank_len) offset = 0;
+			}
+			p = taps;
+			local_limit = 6;
+		}
+		if (local_limit > limit - read_head + 1) local_limit = limit - read_head + 1;
+		if (local_limit > 4096) local_limit = 4096; // keeps 16.16 in range
+		uint32_t pos = (1 << 16) | accumulator;
+		n += kernel(p, out + n, len - n, &pos, playpack_rate, local_limit);
+		read_head += (pos >> 16) - 1;
+		accumulator = pos & 0xFFFF;
+	}
+	return n;
+}
+
+void AudioEffectGranular::setBanks_int(int count)
+{
+	bank_count = count;
+	bank_len = max_sample_len / count;
+	bank_first = 0;
+	bank_used = 0;
+	write_en = false;
+	ring_bank = GRANULAR_MAX_BANKS; // none
 }
 
 void AudioEffectGranular::beginFreeze_int(int grain_samples)
 {
-	__disable_irq();
 	grain_mode = 1;
-	if (grain_samples < max_sample_len) {
+	// the 16.16 accumulator limits the grain to 65535 samples
+	int32_t maximum = segment_start[1];
+	if (maximum > 65535) maximum = 65535;
+	if (grain_samples < maximum) {
 		freeze_len = grain_samples;
 	} else {
-		freeze_len = grain_samples;
+		freeze_len = maximum;
 	}
 	sample_loaded = false;
 	write_en = false;
 	sample_req = true;
-	__enable_irq();
 }
 
 void AudioEffectGranular::beginPitchShift_int(int grain_samples)
 {
-	__disable_irq();
 	grain_mode = 2;
 	if (allow_len_change) {
 		if (grain_samples < 100) grain_samples = 100;
-		int maximum = (max_sample_len - 1) / 3;
+		int32_t maximum = (segment_start[1] - 1) / 3;
+		if (maximum > 65535) maximum = 65535;
 		if (grain_samples > maximum) grain_samples = maximum;
 		glitch_len = grain_samples;
 	}
+	grain_capture = 0;
+	grain_ready = 1;
+	grain_play = 2;
 	sample_loaded = false;
+	play_sample = false;
 	write_en = false;
 	sample_req = true;
-	__enable_irq();
 }
 
 void AudioEffectGranular::beginTimeExpansion_int(int grain_samples)
 {
-	__disable_irq();
-	grain_mode = 3;
+	if (grain_mode != 3) {
+		grain_mode = 3;
+		bank_first = 0;
+		bank_used = 0;
+		write_en = false;
+		ring_bank = GRANULAR_MAX_BANKS; // none
+	}
 	if (allow_len_change) {
 		if (grain_samples > max_sample_len) {
 		grain_samples = max_sample_len;
 	     } 
 		glitch_len = grain_samples;
 	}
-	sample_loaded = false;
-	write_en = false;
 	sample_req = true;
-
-	__enable_irq();
 }
 
 void AudioEffectGranular::beginDivider_int(int grain_samples)
 {
-	__disable_irq();
-	divider_sample=0; //samplecounter
-	read_head=0;
 	grain_mode = 4;
-	if (allow_len_change) {
-		if (grain_samples > max_sample_len) {
-		grain_samples = max_sample_len;
-	     } 
-		glitch_len = grain_samples;
+	divider_env = 0;
+	divider_level = 0;
+	divider_sign = 1;
+	divider_count = 0;
+	divider_high = false;
+}
+
+
+void AudioEffectGranular::beginOverlapShift_int(int grain_samples)
+{
+	grain_mode = 5;
+	// the 16.16 read positions limit the ring to 65535 samples
+	ola_ring_len = segment_start[1] - 1;
+	if (ola_ring_len > 65535) ola_ring_len = 65535;
+	ola_request = grain_samples;
+	fitOverlapLength();
+	ola_write = 0;
+	ola_filled = 0;
+	startOverlapGrains();
+}
+
+// A grain reads ola_len * playpack_rate samples while the write head moves
+// on by ola_len, so it starts that far behind the write head. That start
+// has to stay inside the ring, which limits the grain length at high
+// rates. Below rate 1 the grain falls behind by up to ola_len, the
+// quarter ring limit keeps that inside.
+void AudioEffectGranular::fitOverlapLength(void)
+{
+	int32_t len = ola_request;
+	if (len < 64) len = 64;
+	if (len > ola_ring_len / 4) len = ola_ring_len / 4;
+	uint32_t rate = (playpack_rate > 65536) ? playpack_rate : 65536;
+	int32_t maximum = ((int64_t)(ola_ring_len - AUDIO_BLOCK_SAMPLES - 4) << 16) / rate;
+	if (len > maximum) len = maximum;
+	ola_len = len;
+}
+
+// spread the grains evenly over one grain length
+void AudioEffectGranular::startOverlapGrains(void)
+{
+	ola_step = 0xFFFFFFFF / ola_len;
+	for (int g = 0; g < ola_grains; g++) {
+		ola_phase[g] = g * (0xFFFFFFFF / ola_grains);
+		ola_pos[g] = 0;
 	}
-	sample_loaded = false;
-	write_en = false;
-	sample_req = true;
-	__enable_irq();
 }
 
+// called from the sketch
+bool AudioEffectGranular::post(uint8_t op, int32_t arg)
+{
+	uint8_t head = mailbox_head;
+	uint8_t next = (head + 1) & (GRANULAR_MAILBOX_SIZE - 1);
+	if (next == mailbox_tail) return false;
+	mailbox[head].op = op;
+	mailbox[head].arg = arg;
+	__sync_synchronize(); // command is complete before it is published
+	mailbox_head = next;
+	return true;
+}
 
-void AudioEffectGranular::stop()
+void AudioEffectGranular::applyCommand(uint8_t op, int32_t arg)
 {
-	grain_mode = 0;
-	allow_len_change = true;
+	switch (op) {
+	case CMD_FREEZE:
+		beginFreeze_int(arg);
+		break;
+	case CMD_PITCHSHIFT:
+		beginPitchShift_int(arg);
+		break;
+	case CMD_TIMEEXPANSION:
+		beginTimeExpansion_int(arg);
+		break;
+	case CMD_STOP_TIMEEXPANSION:
+		if (grain_mode == 3) write_en = false;
+		break;
+	case CMD_DIVIDER:
+		beginDivider_int(arg);
+		break;
+	case CMD_STOP:
+		grain_mode = 0;
+		allow_len_change = true;
+		break;
+	case CMD_SPEED:
+		playpack_rate = arg;
+		if (grain_mode == 5) {
+			int32_t len = ola_len;
+			fitOverlapLength();
+			if (ola_len != len) startOverlapGrains();
+		}
+		break;
+	case CMD_INTERPOLATION:
+		interp_mode = arg;
+		break;
+	case CMD_DIVIDER_RATIO:
+		divider = arg;
+		break;
+	case CMD_DIVIDER_SHAPE:
+		divider_shape = arg;
+		break;
+	case CMD_BANKS:
+		setBanks_int(arg);
+		break;
+	case CMD_PRETRIGGER:
+		pre_trigger = arg;
+		break;
+	case CMD_OVERLAPSHIFT:
+		beginOverlapShift_int(arg);
+		break;
+	case CMD_OVERLAP:
+		ola_grains = arg & 0xFF;
+		ola_window = arg >> 8;
+		if (grain_mode == 5) startOverlapGrains();
+		break;
+	}
 }
 
 void AudioEffectGranular::update(void)
 {
-	audio_block_t *block;
+	audio_block_t *block, *out;
 	
 	if (sample_bank == NULL) {
 		block = receiveReadOnly(0);
@@ -122,227 +561,454 @@ void AudioEffectGranular::update(void)
 		return;
 	}
 
-	block = receiveWritable(0);
+	// apply the commands posted since the last block
+	uint8_t tail = mailbox_tail;
+	while (tail != mailbox_head) {
+		__sync_synchronize(); // read the command after its publication
+		applyCommand(mailbox[tail].op, mailbox[tail].arg);
+		tail = (tail + 1) & (GRANULAR_MAILBOX_SIZE - 1);
+		mailbox_tail = tail;
+	}
+
+	// the input block is shared with the other nodes fed by the same
+	// source, so it is only read and the result goes to a new block
+	block = receiveReadOnly(0);
 	
 	if (!block) return;
 
-	if (grain_mode == 0) {
+	if (grain_mode < 1 || grain_mode > 5) {
 		// passthrough, no granular effect
+		trackOnsets(block->data);
 		prev_input = block->data[AUDIO_BLOCK_SAMPLES-1];
+		transmit(block);
+		release(block);
+		return;
 	}
-	else if (grain_mode == 1) {
-		// Freeze - sample 1 grain, then repeatedly play it back
-		for (int j = 0; j < AUDIO_BLOCK_SAMPLES; j++) {
-			if (sample_req) {
-				// only begin capture on zero cross
-				int16_t current_input = block->data[j];
-				if ((current_input < 0 && prev_input >= 0) ||
-				  (current_input >= 0 && prev_input < 0)) {
-					write_en = true;
-					write_head = 0;
-					read_head = 0;
-					sample_req = false;
-				} else {
-					prev_input = current_input;
-				}
-			}
-			if (write_en) {
-				sample_bank[write_head++] = block->data[j];
-				if (write_head >= freeze_len) {
-					sample_loaded = true;
-				}
-				if (write_head >= max_sample_len) {
-					write_en = false;
-				}
-			}
-			if (sample_loaded) {
-				if (playpack_rate >= 0) {
-					accumulator += playpack_rate;
-					read_head = accumulator >> 16;
-				}
-				if (read_head >= freeze_len) {
-					accumulator = 0;
-					read_head = 0;
-				}
-				block->data[j] = sample_bank[read_head];
-			}
-		}
+	out = allocate();
+	if (!out) {
+		trackOnsets(block->data);
+		release(block);
+		return;
 	}
-	else if (grain_mode == 2) {
-		//GLITCH SHIFT
-		//basic granular synth thingy
-		// the shorter the sample the max_sample_len the more tonal it is.
-		// Longer it has more definition.  It's a bit roboty either way which
-		// is obv great and good enough for noise music.
-
-		for (int k = 0; k < AUDIO_BLOCK_SAMPLES; k++) {
-			// only start recording when the audio is crossing zero to minimize pops
-			if (sample_req) {
-				int16_t current_input = block->data[k];
-				if ((current_input < 0 && prev_input >= 0) ||
-				  (current_input >= 0 && prev_input < 0)) {
-					write_en = true;
-				} else {
-					prev_input = current_input;
-				}
-			}
 
-			if (write_en) {
-				sample_req = false;
-				allow_len_change = true; // Reduces noise by not allowing the
-						// length to change after the sample has been
-						// recored.  Kind of not too much though
-				if (write_head >= glitch_len) {
-					write_head = 0;
-					sample_loaded = true;
-					write_en = false;
-					allow_len_change = false;
-				}
-				sample_bank[write_head] = block->data[k];
-				//decimate to half the samples
-
-				write_head++;
-			}
+	// each mode has its own block-wise kernel
+	switch (grain_mode) {
+	case 1:
+		updateFreeze(block->data, out->data);
+		break;
+	case 2:
+		updatePitchShift(block->data, out->data);
+		break;
+	case 3:
+		updateTimeExpansion(block->data, out->data);
+		break;
+	case 4:
+		if (divider_shape == GRANULAR_DIVIDER_SHAPED) {
+			updateDivider<true>(block->data, out->data);
+		} else {
+			updateDivider<false>(block->data, out->data);
+		}
+		break;
+	case 5:
+		updateOverlapShift(block->data, out->data);
+		break;
+	}
+	// after the kernels, a request in this block is measured from the
+	// onsets before it
+	trackOnsets(block->data);
 
-			if (sample_loaded) {
-				//move it to the middle third of the bank.
-				//3 "seperate" banks are used
-				float fade_len = 20.00;
-				int16_t m2 = fade_len;
-
-				for (int m = 0; m < 2; m++) {
-					// I'm off by one somewhere? why is there a tick at the
-					// beginning of this only when it's combined with the
-					// fade out???? ooor am i osbserving that incorrectly
-					// either wait it works enough
-					sample_bank[m + glitch_len] = 0;
-				}
-
-				for (int m = 2; m < glitch_len-m2; m++) {
-					sample_bank[m + glitch_len] = sample_bank[m];
-				}
-
-				for (int m = glitch_len-m2; m < glitch_len; m++) {
-					// fade out the end. You can just make fadet=0
-					// but it's a little too daleky
-					float fadet = sample_bank[m] * (m2 / fade_len);
-					sample_bank[m + glitch_len] = (int16_t)fadet;
-					m2--;
-				}
-				sample_loaded = false;
-				prev_input = block->data[k];
-				sample_req = true;
-			}
+	transmit(out);
+	release(out);
+	release(block);
+}
 
-			accumulator += playpack_rate;
-			read_head = (accumulator >> 16);
+// Finds call onsets in the input, only to measure the trigger latency: the
+// block peak rising well above its background. The background starts from
+// the mean peak of the first blocks, then follows the peaks down within a
+// few blocks and up by about 1/500 per block, so a call hardly lifts it
+// but a louder background is followed within a second.
+void AudioEffectGranular::trackOnsets(const int16_t *in)
+{
+	// the extremes of the block, a loop the compiler can vectorize
+	int16_t lowest = 0, highest = 0;
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		if (in[i] < lowest) lowest = in[i];
+		if (in[i] > highest) highest = in[i];
+	}
+	int32_t peak = (-lowest > highest) ? -lowest : highest;
+	if (onset_blocks < GRANULAR_ONSET_SEED) {
+		onset_noise += peak;
+		if (++onset_blocks == GRANULAR_ONSET_SEED) onset_noise /= GRANULAR_ONSET_SEED;
+		sample_count += AUDIO_BLOCK_SAMPLES;
+		return;
+	}
+	int32_t threshold = onset_noise * 4 + 256;
+	if (peak > threshold) {
+		if (!onset_active) {
+			int i = 0;
+			while (i < AUDIO_BLOCK_SAMPLES - 1 &&
+			  in[i] <= threshold && in[i] >= -threshold) i++;
+			onset_sample = sample_count + i;
+			onset_active = true;
+		}
+	} else {
+		onset_active = false;
+	}
+	if (peak < onset_noise) onset_noise -= (onset_noise - peak) >> 2;
+	else onset_noise += ((peak - onset_noise) >> 9) + 1;
+	sample_count += AUDIO_BLOCK_SAMPLES;
+}
 
-			if (read_head >= glitch_len) {
-				read_head -= glitch_len;
+void AudioEffectGranular::updateFreeze(const int16_t *in, int16_t *out)
+{
+	// Freeze - sample 1 grain, then repeatedly play it back
+	bool playing = sample_loaded;
+	int j = 0;
+	if (sample_req) {
+		// only begin capture on zero cross
+		for (; j < AUDIO_BLOCK_SAMPLES; j++) {
+			int16_t current_input = in[j];
+			if ((current_input < 0 && prev_input >= 0) ||
+			  (current_input >= 0 && prev_input < 0)) {
+				write_en = true;
+				write_head = 0;
+				read_head = 0;
 				accumulator = 0;
-
-				for (int m = 0; m < glitch_len; m++) {
-					sample_bank[m + (glitch_len*2)] = sample_bank[m+glitch_len];
-					//  sample_bank[m + (glitch_len*2)] = (m%20)*1000;
-				}
+				sample_req = false;
+				break;
 			}
-			block->data[k] = sample_bank[read_head + (glitch_len*2)];
+			prev_input = current_input;
 		}
-	} 
-	else if (grain_mode == 3) {
-		//TIME EXPANSION
-		for (int k = 0; k < AUDIO_BLOCK_SAMPLES; k++) 
-		 { 
-			// if a sample is requested
-			// wait with recording until a crossing zero point passes
-			if (sample_req) {
-				write_en = true; //start collecting a sample by setting write_enabled
-				write_head=0; //start at position 0
-				read_head=0;
-				/*int16_t current_input = block->data[k];
-				if ((current_input < 0 && prev_input >= 0) ||
-				  (current_input >= 0 && prev_input < 0)) {
-					write_en = true; //start collecting a sample by setting write_enabled
-					write_head=0; //start at position 0
-					read_head=0;
-				} else {
-					prev_input = current_input;
-				}*/
+	}
+	if (write_en) {
+		int n = freeze_len - write_head;
+		if (n > AUDIO_BLOCK_SAMPLES - j) n = AUDIO_BLOCK_SAMPLES - j;
+		memcpy(sample_bank + write_head, in + j, n * sizeof(int16_t));
+		write_head += n;
+		j += n;
+		if (write_head >= freeze_len) {
+			sample_loaded = true;
+			write_en = false;
+		}
+	}
+	// the input passes through until the grain is complete
+	if (!sample_loaded) j = AUDIO_BLOCK_SAMPLES;
+	else if (playing) j = 0;
+	memcpy(out, in, j * sizeof(int16_t));
+	if (j >= AUDIO_BLOCK_SAMPLES) return;
+	uint32_t acc = accumulator;
+	uint32_t rate = playpack_rate;
+	uint32_t end = (uint32_t)freeze_len << 16;
+	while (j < AUDIO_BLOCK_SAMPLES) {
+		// the samples before the grain wraps need no test
+		uint32_t run = (acc < end) ? (end - 1 - acc) / rate : 0;
+		if (run > (uint32_t)(AUDIO_BLOCK_SAMPLES - j)) run = AUDIO_BLOCK_SAMPLES - j;
+		for (uint32_t i = 0; i < run; i++) {
+			acc += rate;
+			out[j++] = sample_bank[acc >> 16];
+		}
+		if (j >= AUDIO_BLOCK_SAMPLES) break;
+		acc += rate;
+		if ((int32_t)(acc >> 16) >= freeze_len) acc = 0;
+		out[j++] = sample_bank[acc >> 16];
+	}
+	accumulator = acc;
+	read_head = acc >> 16;
+}
 
+void AudioEffectGranular::updatePitchShift(const int16_t *in, int16_t *out)
+{
+	//GLITCH SHIFT
+	//basic granular synth thingy
+	// the shorter the sample the max_sample_len the more tonal it is.
+	// Longer it has more definition.  It's a bit roboty either way which
+	// is obv great and good enough for noise music.
+
+	// The bank holds 3 grains: the one being recorded, the latest
+	// complete one and the one being played.  Grains are handed on by
+	// swapping their indices, so nothing gets copied in here.
+	int k = 0;
+	if (sample_req) {
+		// only start recording when the audio is crossing zero to minimize pops
+		for (; k < AUDIO_BLOCK_SAMPLES; k++) {
+			int16_t current_input = in[k];
+			if ((current_input < 0 && prev_input >= 0) ||
+			  (current_input >= 0 && prev_input < 0)) {
+				sample_req = false;
+				write_en = true;
+				write_head = 0;
+				allow_len_change = true; // Reduces noise by not allowing the
+					// length to change after the sample has been
+					// recored.  Kind of not too much though
+				break;
 			}
+			prev_input = current_input;
+		}
+	}
+
+	if (write_en) {
+		int n = glitch_len - write_head;
+		if (n > AUDIO_BLOCK_SAMPLES - k) n = AUDIO_BLOCK_SAMPLES - k;
+		memcpy(sample_bank + grain_capture * glitch_len + write_head,
+			in + k, n * sizeof(int16_t));
+		write_head += n;
+		if (write_head >= glitch_len) {
+			uint8_t done = grain_capture;
+			grain_capture = grain_ready;
+			grain_ready = done;
+			sample_loaded = true;
+			write_en = false;
+			allow_len_change = false;
+			prev_input = in[k + n - 1];
+			sample_req = true;
+		}
+	}
 
-            //active collecting of all incoming data if write_enabled
-			if (write_en) {
-				sample_req = false; // stop sample request as we are recording
-				
-				// collect until glitch_len samples are available in the sample_bank
-				if (write_head >= glitch_len) {
-					//write_head = 0;
-					//accumulator= 0;
-					sample_loaded = true; //sample_bank is full 
-					write_en = false; // stop sampling
-				}
-
-				play_sample=true;
-				sample_bank[write_head]= block->data[k];
-				write_head++; // next sample
-			   
+	const int16_t *grain = sample_bank + grain_play * glitch_len;
+	int32_t fade_start = glitch_len - 20;
+	uint32_t acc = accumulator;
+	uint32_t rate = playpack_rate;
+	uint32_t fade = (uint32_t)fade_start << 16;
+	k = 0;
+	while (k < AUDIO_BLOCK_SAMPLES) {
+		// between the first two samples of the grain and its fade out
+		// every sample is played as it is
+		uint32_t run = 0;
+		if (acc + rate >= (2 << 16) && acc < fade) run = (fade - 1 - acc) / rate;
+		if (run > (uint32_t)(AUDIO_BLOCK_SAMPLES - k)) run = AUDIO_BLOCK_SAMPLES - k;
+		if (play_sample) {
+			for (uint32_t i = 0; i < run; i++) {
+				acc += rate;
+				out[k++] = grain[acc >> 16];
 			}
+		} else {
+			acc += rate * run;
+			for (uint32_t i = 0; i < run; i++) out[k++] = 0;
+		}
+		if (k >= AUDIO_BLOCK_SAMPLES) break;
+
+		acc += rate;
+		read_head = (acc >> 16);
 
-            //sample bank is full and can be used to transfer back to the audio system
+		if (read_head >= glitch_len) {
+			read_head -= glitch_len;
+			acc = 0;
+			// start playing the latest complete grain
 			if (sample_loaded) {
-				
-			}
-            
-			 
-			if (play_sample)
-			 { accumulator += playpack_rate; // shift sampleposition
-			   read_head = (accumulator >> 16); //rightshift 16 == div by 65535 
-			 }
-
-			 /*
-			 if (play_sample)
-			  { accumulator++;
-			    read_head = accumulator * Rdivider;
-			  }
-		*/
-
-			//glitch_len equals array_size
-			if (read_head >= write_head) {
-				read_head = 0;
-				accumulator = 0;
-                sample_req = false; //we dont want a new sample
+				uint8_t next = grain_ready;
+				grain_ready = grain_play;
+				grain_play = next;
+				grain = sample_bank + grain_play * glitch_len;
 				sample_loaded = false;
-				play_sample=false;
+				play_sample = true;
 			}
-         
-			block->data[k] = sample_bank[read_head];
-			
 		}
-	} 
-	else if (grain_mode == 4) {
-		//FREQUENCY DIVIDER
-		// todo: change into continous averaged sampling by adding a new block->data and removing the oldest from the samples
-		//       array. Average calculation can be done as new_average = last_average - oldest_data*0.1 + latest_data*0.1
-        uint8_t dividerset=10;
-		
-		//needs very little memory, only X=dividerset samples[X] 
-		for (int k = 0; k < AUDIO_BLOCK_SAMPLES; k++) 
-		 {   sample_bank[divider_sample%dividerset]= block->data[k];  //store current readout in revolving arrayposition
-	         block->data[k] = sample_bank[0]; //output is always based on the same arrayposition
-			 divider_sample++;
+
+		int32_t val = grain[read_head];
+		if (!play_sample || read_head < 2) {
+			// I'm off by one somewhere? why is there a tick at the
+			// beginning of this only when it's combined with the
+			// fade out???? ooor am i osbserving that incorrectly
+			// either wait it works enough
+			val = 0;
+		} else if (read_head >= fade_start) {
+			// fade out the end over 20 samples. You can just make it 0
+			// but it's a little too daleky
+			val = (val * ((glitch_len - read_head) * 1638)) >> 15;
 		}
-         //roll over the sample_counter at a safe point (block_size*divider) so all blocks are based on equal datasets
-		if (divider_sample>=AUDIO_BLOCK_SAMPLES*dividerset)
-		 {  divider_sample=0;
-		 }
-		  
-	  }
-	  
-	transmit(block);
-	release(block);
+		out[k++] = val;
+	}
+	accumulator = acc;
+	read_head = acc >> 16;
 }
 
+void AudioEffectGranular::updateTimeExpansion(const int16_t *in, int16_t *out)
+{
+	//TIME EXPANSION
+	// every requested sample gets its own bank. Banks are recorded and
+	// played in round robin order, so the next call can be recorded
+	// while an earlier one is still playing
+
+	// while nothing is being recorded, the next free bank records the
+	// input as a ring, so a request can keep the samples before it
+	if (!write_en && bank_used < bank_count) {
+		uint8_t free_bank = (bank_first + bank_used) % bank_count;
+		if (free_bank != ring_bank) {
+			ring_bank = free_bank;
+			ring_pos = 0;
+			ring_filled = 0;
+		}
+	}
+
+	if (sample_req) {
+		sample_req = false;
+		if (write_en) {
+			// still recording this call
+		} else if (bank_used >= bank_count) {
+			dropped_calls++;
+		} else {
+			int32_t pre = pre_trigger;
+			if (pre > ring_filled) pre = ring_filled;
+			if (pre > bank_len - 1) pre = bank_len - 1;
+			bank_capture = ring_bank;
+			bank_fill[bank_capture] = pre;
+			bank_start[bank_capture] = ring_pos - pre;
+			if (bank_start[bank_capture] < 0) bank_start[bank_capture] += bank_len;
+			if (bank_used == 0) {
+				read_head = 1; // kernels look one sample back
+				accumulator = 0;
+			}
+			bank_used++;
+			write_en = true;
+			trigger_latency = onset_active ? (int32_t)(sample_count - onset_sample) : -1;
+		}
+	}
+
+	//collect the incoming block, until the bank is full once a sample was
+	//requested
+	if (write_en || bank_used < bank_count) {
+		int n = AUDIO_BLOCK_SAMPLES;
+		if (write_en) {
+			int32_t len = (glitch_len < bank_len) ? glitch_len : bank_len;
+			if (n > len - bank_fill[bank_capture]) n = len - bank_fill[bank_capture];
+			bank_fill[bank_capture] += n;
+			if (bank_fill[bank_capture] >= len) write_en = false;
+		} else {
+			ring_filled += n;
+			if (ring_filled > bank_len) ring_filled = bank_len;
+		}
+		const int16_t *src = in;
+		while (n > 0) {
+			int32_t run;
+			int16_t *dst = ringPtr(ring_bank, ring_pos, &run);
+			if (run > n) run = n;
+			memcpy(dst, src, run * sizeof(int16_t));
+			src += run;
+			n -= run;
+			ring_pos += run;
+			if (ring_pos >= bank_len) ring_pos = 0;
+		}
+	}
 
+	// playback follows the write head at playpack_rate and moves on
+	// to the next queued bank without a gap
+	int n = 0;
+	while (bank_used > 0 && n < AUDIO_BLOCK_SAMPLES) {
+		n += renderBank(bank_first, out + n,
+			AUDIO_BLOCK_SAMPLES - n, bank_fill[bank_first] - 2);
+		if (n >= AUDIO_BLOCK_SAMPLES) break;
+		// playback caught up with the recording
+		if (write_en && bank_capture == bank_first) break;
+		bank_first = (bank_first + 1) % bank_count;
+		bank_used--;
+		read_head = 1;
+		accumulator = 0;
+	}
+	// silence when idle
+	for (; n < AUDIO_BLOCK_SAMPLES; n++) {
+		out[n] = 0;
+	}
+}
 
+template <bool shaped>
+void AudioEffectGranular::updateDivider(const int16_t *in, int16_t *out)
+{
+	//FREQUENCY DIVIDER
+	// count zero crossings of the input, with a hysteresis of 1/8th of
+	// the envelope to ignore noise, and flip the output every divider
+	// crossings. A full output period takes 2*divider crossings, which
+	// is divider input periods. The output follows the input envelope.
+	int32_t env = divider_env;
+	int32_t level = divider_level;
+	bool high = divider_high;
+	int32_t count = divider_count;
+	int32_t sign = divider_sign;
+	int32_t ratio = divider;
+	for (int k = 0; k < AUDIO_BLOCK_SAMPLES; k++) {
+		int32_t x = in[k];
+		int32_t mag = ((x < 0) ? -x : x) << 8;
+		// fast attack, slow release. Noise makes these tests random, so
+		// they are written as selects rather than branches.
+		int32_t rise = env + ((mag - env) >> 2);
+		int32_t fall = env - ((env - mag) >> 9);
+		env = (mag > env) ? rise : fall;
+
+		int32_t hyst = (env >> 11) + 32;
+		bool cross = high ? (x < -hyst) : (x > hyst);
+		high ^= cross;
+		count += cross;
+		bool flip = count >= ratio;
+		count = flip ? 0 : count;
+		sign = flip ? -sign : sign;
+
+		int32_t val = sign * (env >> 8);
+		if (shaped) {
+			level += (val - level) >> 3;
+			val = level;
+		}
+		out[k] = te_saturate(val);
+	}
+	divider_env = env;
+	divider_level = level;
+	divider_high = high;
+	divider_count = count;
+	divider_sign = sign;
+}
 
+void AudioEffectGranular::updateOverlapShift(const int16_t *in, int16_t *out)
+{
+	//OVERLAP-ADD PITCH SHIFT
+	// The input is recorded into a ring.  Each grain reads a stretch of it
+	// at playpack_rate through a window, so the pitch changes but the
+	// timing does not.  A grain restarts when its window ends, far enough
+	// behind the write head that it never overtakes it; fitOverlapLength()
+	// keeps that start inside the ring.
+	int16_t *ring = sample_bank;
+	int32_t ring_len = ola_ring_len;
+	int32_t block_start = ola_write;
+
+	const int16_t *src = in;
+	int n = AUDIO_BLOCK_SAMPLES;
+	while (n > 0) {
+		int32_t run = ring_len - ola_write;
+		if (run > n) run = n;
+		memcpy(ring + ola_write, src, run * sizeof(int16_t));
+		if (ola_write == 0) ring[ring_len] = ring[0]; // for interpolation
+		src += run;
+		n -= run;
+		ola_write += run;
+		if (ola_write >= ring_len) ola_write = 0;
+	}
+	// stay silent until the ring holds only fresh input
+	bool ready = ola_filled >= ring_len;
+	if (!ready) ola_filled += AUDIO_BLOCK_SAMPLES;
+
+	uint32_t rate = playpack_rate;
+	int32_t delay = ((int64_t)ola_len * (rate > 65536 ? rate : 65536) >> 16) + 2;
+	const int16_t *window = (ola_window == GRANULAR_WINDOW_HANN) ?
+		ola_window_hann : ola_window_trapezoid[ola_grains - 2];
+	int32_t gain = ola_gain[ola_window][ola_grains - 2];
+	uint32_t wrap = (uint32_t)ring_len << 16;
+
+	for (int j = 0; j < AUDIO_BLOCK_SAMPLES; j++) {
+		int32_t sum = 0;
+		for (int g = 0; g < ola_grains; g++) {
+			uint32_t phase = ola_phase[g] + ola_step;
+			if (phase < ola_phase[g]) {
+				int32_t start = block_start + j - delay;
+				if (start < 0) start += ring_len;
+				ola_pos[g] = (uint32_t)start << 16;
+			}
+			ola_phase[g] = phase;
+			uint32_t pos = ola_pos[g];
+			const int16_t *p = ring + (pos >> 16);
+			int32_t t = (pos >> 1) & 0x7FFF;
+			int32_t x = p[0] + (((p[1] - p[0]) * t) >> 15);
+			sum += (x * window[phase >> 24]) >> 15;
+			pos += rate;
+			if (pos >= wrap) pos -= wrap;
+			ola_pos[g] = pos;
+		}
+		out[j] = ready ? te_saturate((sum * gain) >> 15) : 0;
+	}
+}
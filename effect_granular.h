@@ -23,71 +23,232 @@
 
 #include "AudioStream.h"
 
+// playback kernels for time expansion (grain_mode 3)
+#define GRANULAR_INTERP_NONE     0  // truncate, repeats each sample
+#define GRANULAR_INTERP_LINEAR   1  // 2-point linear
+#define GRANULAR_INTERP_HERMITE  2  // 4-point cubic Hermite (Catmull-Rom)
+#define GRANULAR_INTERP_FIR      3  // 4-tap, 32-phase windowed sinc
+
+// time expansion can split the sample bank into banks that take turns:
+// one records the next call while an earlier one is played back
+#define GRANULAR_MAX_BANKS       4
+
+// the bank may be split over several buffers, e.g. RAM and external PSRAM
+#define GRANULAR_MAX_SEGMENTS    4
+
+// overlap-add pitch shift (grain_mode 5)
+#define GRANULAR_MAX_GRAINS      4
+#define GRANULAR_WINDOW_HANN     0
+#define GRANULAR_WINDOW_TRAPEZOID 1
+
+// commands waiting for the next update(), a power of 2
+#define GRANULAR_MAILBOX_SIZE    16
+
+// blocks whose peaks start the onset background after begin()
+#define GRANULAR_ONSET_SEED      8
+
+// frequency divider (grain_mode 4) output waveforms
+#define GRANULAR_DIVIDER_SQUARE  0
+#define GRANULAR_DIVIDER_SHAPED  1  // square with rounded edges
+
 class AudioEffectGranular : public AudioStream
 {
 public:
-	AudioEffectGranular(void): AudioStream(1,inputQueueArray) { }
-	void begin(int16_t *sample_bank_def, int16_t max_len_def);
+	AudioEffectGranular(void): AudioStream(1,inputQueueArray) {
+		sample_bank = NULL;
+		mailbox_head = 0;
+		mailbox_tail = 0;
+	}
+	void begin(int16_t *sample_bank_def, int32_t max_len_def);
+	// time expansion uses all segments as one bank, freeze and pitch
+	// shift only use the first segment
+	void begin(int16_t **segments, const int32_t *lengths, int count);
+	// Parameter changes and mode switches are posted to a mailbox and
+	// applied by update() at the next block boundary, so they never need
+	// to disable interrupts. A full mailbox drops the command.
 	void setSpeed(float ratio) {
 		if (ratio < 0.01) ratio = 0.01;
 		else if (ratio > 8.0) ratio = 8.0;
-		playpack_rate = ratio * 65536.0 + 0.499;
-
+		post(CMD_SPEED, ratio * 65536.0 + 0.499);
 	}
+	// frequency divider: output toggles every ratio zero crossings
 	void setdivider(int ratio) {
-		if (ratio < 1) ratio = 1;
+		if (ratio < 2) ratio = 2;
 		else if (ratio > 50) ratio = 50;
-		Rdivider=1/ratio;
+		post(CMD_DIVIDER_RATIO, ratio);
+	}
+	void setDividerShape(int shape) {
+		post(CMD_DIVIDER_SHAPE, (shape == GRANULAR_DIVIDER_SHAPED) ? shape : GRANULAR_DIVIDER_SQUARE);
+	}
+	void setInterpolation(int mode) {
+		if (mode < GRANULAR_INTERP_NONE) mode = GRANULAR_INTERP_NONE;
+		else if (mode > GRANULAR_INTERP_FIR) mode = GRANULAR_INTERP_FIR;
+		post(CMD_INTERPOLATION, mode);
 	}
 	
 	void beginFreeze(float grain_length) {
 		if (grain_length <= 0.0) return;
-		beginFreeze_int(grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
+		post(CMD_FREEZE, grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
 	}
 
 	void beginPitchShift(float grain_length) {
 		if (grain_length <= 0.0) return;
-		beginPitchShift_int(grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
+		post(CMD_PITCHSHIFT, grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
 	}
 	
 	void beginTimeExpansion(float grain_length) {
 		if (grain_length <= 0.0) return;
-		beginTimeExpansion_int(grain_length);
-		
+		post(CMD_TIMEEXPANSION, grain_length);
 	}
 	
-    void stopTimeExpansion()
-	 {
-		 sample_loaded=true;
-		 //sample_req=false;
+	// close the recording of the current call, its bank stays queued
+	// for playback
+	void stopTimeExpansion() {
+		post(CMD_STOP_TIMEEXPANSION, 0);
+	}
 
-	 }
+	void setBanks(int count) {
+		if (count < 1) count = 1;
+		else if (count > GRANULAR_MAX_BANKS) count = GRANULAR_MAX_BANKS;
+		post(CMD_BANKS, count);
+	}
+	// samples from before the request that are kept at the start of each
+	// time expansion bank, to include the call onset the detector missed
+	void setPreTrigger(int32_t samples) {
+		if (samples < 0) samples = 0;
+		post(CMD_PRETRIGGER, samples);
+	}
+	// samples between the last onset seen in the input and the time
+	// expansion request that followed it, -1 if there was none. Onsets
+	// are tracked in every mode, so a request that enters time expansion
+	// is measured too.
+	int32_t triggerLatency(void) { return trigger_latency; }
+	// calls that found every bank busy since begin()
+	uint32_t droppedCalls(void) { return dropped_calls; }
+	// recorded calls waiting for or in playback
+	int queuedCalls(void) { return bank_used; }
+
+	// pitch shift by playpack_rate that keeps the timing, built from 2 to 4
+	// overlapping windowed grains of grain_length milliseconds. Grains are
+	// at most a quarter of the first segment, and shorter at high speeds,
+	// where they must read speed times their length from the ring.
+	void beginOverlapShift(float grain_length) {
+		if (grain_length <= 0.0) return;
+		post(CMD_OVERLAPSHIFT, grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
+	}
+	void setOverlap(int grains, int window) {
+		if (grains < 2) grains = 2;
+		else if (grains > GRANULAR_MAX_GRAINS) grains = GRANULAR_MAX_GRAINS;
+		if (window != GRANULAR_WINDOW_TRAPEZOID) window = GRANULAR_WINDOW_HANN;
+		post(CMD_OVERLAP, grains | (window << 8));
+	}
 
 	void beginDivider(float grain_length) {
 		if (grain_length <= 0.0) return;
-		beginDivider_int(grain_length);
+		post(CMD_DIVIDER, grain_length);
 	}
 	
-	void stop();
+	void stop() {
+		post(CMD_STOP, 0);
+	}
 	virtual void update(void);
 private:
+	enum {
+		CMD_FREEZE,
+		CMD_PITCHSHIFT,
+		CMD_TIMEEXPANSION,
+		CMD_STOP_TIMEEXPANSION,
+		CMD_DIVIDER,
+		CMD_STOP,
+		CMD_SPEED,
+		CMD_INTERPOLATION,
+		CMD_DIVIDER_RATIO,
+		CMD_DIVIDER_SHAPE,
+		CMD_BANKS,
+		CMD_PRETRIGGER,
+		CMD_OVERLAPSHIFT,
+		CMD_OVERLAP
+	};
+	struct command {
+		uint8_t op;
+		int32_t arg;
+	};
+	bool post(uint8_t op, int32_t arg);
+	void applyCommand(uint8_t op, int32_t arg);
 	void beginFreeze_int(int grain_samples);
 	void beginPitchShift_int(int grain_samples);
 	void beginTimeExpansion_int(int grain_samples);
 	void beginDivider_int(int grain_samples);
+	void setBanks_int(int count);
+	void beginOverlapShift_int(int grain_samples);
+	void fitOverlapLength(void);
+	void startOverlapGrains(void);
+	void updateFreeze(const int16_t *in, int16_t *out);
+	void updatePitchShift(const int16_t *in, int16_t *out);
+	void updateTimeExpansion(const int16_t *in, int16_t *out);
+	template <bool shaped> void updateDivider(const int16_t *in, int16_t *out);
+	void updateOverlapShift(const int16_t *in, int16_t *out);
+	void trackOnsets(const int16_t *in);
+	int16_t *bankPtr(int32_t pos, int32_t *run);
+	int16_t *ringPtr(uint8_t bank, int32_t offset, int32_t *run);
+	int renderBank(uint8_t bank, int16_t *out, int len, int32_t limit);
 	audio_block_t *inputQueueArray[1];
+	// single producer (the sketch), single consumer (update)
+	command mailbox[GRANULAR_MAILBOX_SIZE];
+	volatile uint8_t mailbox_head;
+	volatile uint8_t mailbox_tail;
 	int16_t *sample_bank;
+	int16_t *segment[GRANULAR_MAX_SEGMENTS];
+	int32_t segment_start[GRANULAR_MAX_SEGMENTS + 1];
+	uint8_t segment_count;
 	uint32_t playpack_rate;
-	float Rdivider;
 	uint32_t accumulator;
-	int16_t max_sample_len;
-	int16_t write_head;
-	int16_t read_head;
+	int32_t max_sample_len;
+	int32_t write_head;
+	int32_t read_head;
 	int16_t grain_mode;
-	int16_t freeze_len;
+	int32_t freeze_len;
 	int16_t prev_input;
-	int16_t glitch_len;
-	int32_t divider_sample;
+	int32_t glitch_len;
+	int32_t divider_env;    // input envelope, Q8
+	int32_t divider_level;  // shaped output
+	int16_t divider_sign;
+	uint8_t divider;
+	uint8_t divider_count;
+	uint8_t divider_shape;
+	bool divider_high;
+	uint8_t interp_mode;
+	uint8_t bank_count;
+	uint8_t bank_first; // bank being played, others follow round robin
+	uint8_t bank_used;
+	uint8_t bank_capture;
+	int32_t bank_len;
+	int32_t bank_fill[GRANULAR_MAX_BANKS];
+	int32_t bank_start[GRANULAR_MAX_BANKS]; // banks are rings, first sample
+	uint8_t ring_bank;   // free bank recording before a request
+	int32_t ring_pos;
+	int32_t ring_filled;
+	int32_t pre_trigger;
+	uint32_t sample_count;
+	uint32_t onset_sample;
+	int32_t onset_noise;  // background block peak
+	uint8_t onset_blocks; // blocks summed into onset_noise while seeding
+	bool onset_active;
+	int32_t trigger_latency;
+	uint32_t dropped_calls;
+	uint8_t grain_capture; // pitch shift grains, as thirds of the bank
+	uint8_t grain_ready;
+	uint8_t grain_play;
+	int32_t ola_ring_len; // overlap-add input ring, plus one guard sample
+	int32_t ola_write;
+	int32_t ola_filled;
+	int32_t ola_len;
+	int32_t ola_request; // grain length asked for, ola_len may be shorter
+	uint32_t ola_step;    // window phase step, one grain is 2^32
+	uint32_t ola_phase[GRANULAR_MAX_GRAINS];
+	uint32_t ola_pos[GRANULAR_MAX_GRAINS];
+	uint8_t ola_grains;
+	uint8_t ola_window;
 
     bool play_sample;
 	bool allow_len_change;
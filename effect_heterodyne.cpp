@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "effect_heterodyne.h"
+#include "nco_sine.h"
+
+// Hamming windowed Hilbert transformer, taps at offsets 1, 3, .. 47 from the
+// centre, Q15. The taps at negative offsets have the opposite sign.
+static const int16_t hilbert_taps[(HETERODYNE_HILBERT_TAPS + 1) / 4] = {
+	20840, 6892, 4070, 2839, 2138, 1680, 1353, 1106,
+	912, 755, 626, 517, 425, 348, 282, 226,
+	180, 141, 109, 84, 65, 51, 41, 36
+};
+
+static inline void cic_integrate(uint32_t *integrator, int32_t x)
+{
+	integrator[0] += x;
+	integrator[1] += integrator[0];
+	integrator[2] += integrator[1];
+}
+
+// a 3rd order CIC has a gain of R^3, gain_shift divides it out
+static inline int32_t cic_decimate(const uint32_t *integrator, uint32_t *comb, uint8_t gain_shift)
+{
+	uint32_t c0 = integrator[2];
+	uint32_t c1 = c0 - comb[0];
+	uint32_t c2 = c1 - comb[1];
+	uint32_t c3 = c2 - comb[2];
+	comb[0] = c0;
+	comb[1] = c1;
+	comb[2] = c2;
+	return (int32_t)c3 >> gain_shift;
+}
+
+// The CIC and the linear interpolation together fall off like sinc^5 of
+// f / filter rate. -a, 1 + 2a, -a with a = 9/32 lifts that back to within
+// 0.2 dB up to a quarter of the filter rate.
+static inline int32_t droop_correct(int32_t *history, int32_t x)
+{
+	int32_t centre = history[0];
+	int32_t y = centre + ((9 * (2 * centre - x - history[1])) >> 5);
+	history[1] = centre;
+	history[0] = x;
+	return y;
+}
+
+void AudioEffectHeterodyne::reset(void)
+{
+	for (int n = 0; n < 2; n++) {
+		channel_state &ch = channel[n];
+		ch.decimate_count = 0;
+		for (int c = 0; c < 2; c++) {
+			for (int i = 0; i < 3; i++) {
+				ch.cic[c].integrator[i] = 0;
+				ch.cic[c].comb[i] = 0;
+			}
+		}
+		ch.out_prev = 0;
+		ch.out_next = 0;
+		ch.droop[0] = 0;
+		ch.droop[1] = 0;
+	}
+	for (int i = 0; i < 128; i++) {
+		i_history[i] = 0;
+		q_history[i] = 0;
+	}
+	history_pos = 0;
+}
+
+void AudioEffectHeterodyne::update(void)
+{
+	audio_block_t *block, *out, *second;
+
+	// the input block is shared with the other nodes fed by the same
+	// source, so it is only read and each output gets a new block
+	block = receiveReadOnly(0);
+	out = block ? allocate() : NULL;
+	if (!out) {
+		// keep the oscillators running
+		if (block) release(block);
+		for (int n = 0; n < 2; n++) {
+			channel[n].phase_increment = channel[n].increment_target;
+			channel[n].phase_accumulator += channel[n].phase_increment * AUDIO_BLOCK_SAMPLES;
+		}
+		return;
+	}
+	if (decimate_req != decimate_shift || sideband_req != sideband_mode) {
+		decimate_shift = decimate_req;
+		sideband_mode = sideband_req;
+		reset();
+	}
+	if (channel[1].increment_target != 0 || channel[1].phase_increment != 0) {
+		second = allocate();
+		if (second) {
+			mix<HETERODYNE_DSB>(channel[1], block->data, second->data);
+			transmit(second, 1);
+			release(second);
+		} else {
+			channel[1].phase_increment = channel[1].increment_target;
+			channel[1].phase_accumulator += channel[1].phase_increment * AUDIO_BLOCK_SAMPLES;
+		}
+	}
+	switch (sideband_mode) {
+	case HETERODYNE_USB:
+		mix<HETERODYNE_USB>(channel[0], block->data, out->data);
+		break;
+	case HETERODYNE_LSB:
+		mix<HETERODYNE_LSB>(channel[0], block->data, out->data);
+		break;
+	default:
+		mix<HETERODYNE_DSB>(channel[0], block->data, out->data);
+	}
+	transmit(out);
+	release(out);
+	release(block);
+}
+
+// one block of in mixed with the oscillator of ch into out. in is the
+// shared input block, read only, and out is always a block of its own
+template <int mode>
+void AudioEffectHeterodyne::mix(channel_state &ch, const int16_t *in, int16_t *out)
+{
+	uint32_t ph = ch.phase_accumulator;
+	uint32_t inc = ch.phase_increment;
+	uint32_t target = ch.increment_target;
+	// linear frequency glide over the block
+	int32_t inc_step = (int32_t)(target - inc) / AUDIO_BLOCK_SAMPLES;
+	uint8_t shift = decimate_shift;
+	uint8_t mask = (1 << shift) - 1;
+	uint8_t gain_shift = shift * 3;
+	uint8_t count = ch.decimate_count;
+	int32_t out_prev = ch.out_prev;
+	int32_t out_next = ch.out_next;
+	int32_t mag = magnitude;
+
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		int32_t x = in[i];
+		cic_integrate(ch.cic[0].integrator, (x * nco_sine(ph)) >> 15);
+		if (mode != HETERODYNE_DSB) {
+			// cosine, a quarter turn ahead
+			cic_integrate(ch.cic[1].integrator, (x * nco_sine(ph + 0x40000000)) >> 15);
+		}
+		ph += inc;
+		inc += inc_step;
+
+		// output runs one decimated sample behind, interpolating towards
+		// the newest filter output
+		int32_t val = out_prev + (((out_next - out_prev) * count) >> shift);
+		val = (val * mag) >> 15;
+		if (val > 32767) val = 32767;
+		else if (val < -32768) val = -32768;
+		out[i] = val;
+
+		count = (count + 1) & mask;
+		if (count != 0) continue;
+		int32_t y = cic_decimate(ch.cic[0].integrator, ch.cic[0].comb, gain_shift);
+		if (mode != HETERODYNE_DSB) {
+			// With a sine oscillator, I = -sin(d) / 2 and Q = cos(d) / 2 for
+			// a signal d above it; H(Q) - I keeps it, H(Q) + I keeps
+			// signals below. I is delayed to the centre of the FIR.
+			uint8_t pos = (history_pos + 1) & 127;
+			history_pos = pos;
+			i_history[pos] = y;
+			q_history[pos] = cic_decimate(ch.cic[1].integrator, ch.cic[1].comb, gain_shift);
+			uint8_t centre = pos - HETERODYNE_HILBERT_TAPS / 2;
+			int64_t acc = 0;
+			for (int k = 0; k < (HETERODYNE_HILBERT_TAPS + 1) / 4; k++) {
+				int32_t older = q_history[(uint8_t)(centre - 2 * k - 1) & 127];
+				int32_t newer = q_history[(uint8_t)(centre + 2 * k + 1) & 127];
+				acc += (int64_t)hilbert_taps[k] * (older - newer);
+			}
+			int32_t h = acc >> 15;
+			int32_t delayed = i_history[centre & 127];
+			// both quadrature halves add up, halve to match the DSB level
+			if (mode == HETERODYNE_USB) y = (h - delayed) >> 1;
+			else y = (h + delayed) >> 1;
+		}
+		// without decimation there is no droop
+		if (shift) y = droop_correct(ch.droop, y);
+		out_prev = out_next;
+		out_next = y;
+	}
+	ch.phase_accumulator = ph;
+	ch.phase_increment = target;
+	ch.decimate_count = count;
+	ch.out_prev = out_prev;
+	ch.out_next = out_next;
+}
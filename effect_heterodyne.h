@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef effect_heterodyne_h_
+#define effect_heterodyne_h_
+
+#include "AudioStream.h"
+
+// largest low-pass decimation factor, a power of 2
+#define HETERODYNE_MAX_DECIMATION 16
+
+// sidebands that reach the output
+#define HETERODYNE_DSB           0  // both, as a plain multiply
+#define HETERODYNE_USB           1  // signals above the oscillator
+#define HETERODYNE_LSB           2  // signals below the oscillator
+
+// Hilbert transformer for single sideband, odd taps at the decimated rate
+#define HETERODYNE_HILBERT_TAPS  95
+
+// lowest rate the low-pass may decimate to, Hz. The audible band stays
+// below a quarter of it, where the droop correction keeps it flat.
+#define HETERODYNE_MIN_FILTER_RATE 64000
+
+// Heterodyne mixer: a sine local oscillator, the multiply and a decimating
+// low-pass in one node. The low-pass is a 3rd order CIC that runs at the
+// input rate and decimates by 1 to 16, its output is linearly interpolated
+// back to the input rate. A 3 tap FIR at the decimated rate corrects the
+// droop of both. With the decimation setSampleRate() picks, difference
+// frequencies up to 15 kHz stay within 1 dB and 18 kHz within 1.5 dB, at
+// 192 to 352.8 kHz. Above that the output falls off. Differences that
+// would fold back below 18 kHz are at least 30 dB down.
+// For single sideband the oscillator runs in quadrature, I and Q each get
+// their own CIC and Q passes a Hilbert FIR at the decimated rate, so a call
+// 5 kHz above the oscillator no longer sounds the same as one 5 kHz below.
+// From 2 to 15 kHz the other sideband is at least 50 dB down.
+// A second, independently tuned oscillator mixes the same input to output 1,
+// e.g. one headphone channel per species band. It is off until tuned and
+// always mixes both sidebands.
+class AudioEffectHeterodyne : public AudioStream
+{
+public:
+	AudioEffectHeterodyne(void): AudioStream(1, inputQueueArray) {
+		for (int n = 0; n < 2; n++) {
+			channel[n].phase_accumulator = 0;
+			channel[n].phase_increment = 0;
+			channel[n].increment_target = 0;
+			lo_freq[n] = 0;
+		}
+		sample_rate = AUDIO_SAMPLE_RATE_EXACT;
+		magnitude = 16384;
+		decimate_shift = 0;
+		decimate_req = 0;
+		sideband_mode = HETERODYNE_DSB;
+		sideband_req = HETERODYNE_DSB;
+		reset();
+	}
+	// the rate the codec really runs at, AUDIO_SAMPLE_RATE_EXACT until set.
+	// Retunes the oscillators and picks the largest decimation that keeps
+	// the low-pass at HETERODYNE_MIN_FILTER_RATE or more.
+	void setSampleRate(float rate) {
+		if (rate < 1.0) return;
+		sample_rate = rate;
+		int factor = 1;
+		while (factor < HETERODYNE_MAX_DECIMATION && rate / (factor * 2) >= HETERODYNE_MIN_FILTER_RATE) factor *= 2;
+		decimation(factor);
+		frequency(0, lo_freq[0]);
+		frequency(1, lo_freq[1]);
+	}
+	// local oscillator frequency in Hz at the real sample rate, up to
+	// Nyquist; the 32 bit phase steps are 82 uHz at 352.8 kHz.
+	// The oscillator glides to it over the next update() without a phase
+	// jump, so it may be called every block to track a call.
+	void frequency(float freq) {
+		frequency(0, freq);
+	}
+	// oscillator 0 feeds output 0, oscillator 1 feeds output 1; 0 Hz turns
+	// oscillator 1 and its output off
+	void frequency(int n, float freq) {
+		if (n < 0 || n > 1) return;
+		if (freq < 0.0) freq = 0.0;
+		else if (freq > sample_rate / 2) freq = sample_rate / 2;
+		lo_freq[n] = freq;
+		channel[n].increment_target = freq / sample_rate * 4294967296.0 + 0.5;
+	}
+	// local oscillator level, 0.5 matches AudioSynthWaveformSineHires
+	// followed by AudioEffectMultiply
+	void amplitude(float n) {
+		if (n < 0) n = 0;
+		else if (n > 1.0) n = 1.0;
+		magnitude = n * 32767.0;
+	}
+	// low-pass decimation factor, rounded down to a power of 2; the filter
+	// state is cleared at the next update()
+	void decimation(int factor) {
+		uint8_t shift = 0;
+		while (shift < 4 && (2 << shift) <= factor) shift++;
+		decimate_req = shift;
+	}
+	// HETERODYNE_DSB, HETERODYNE_USB or HETERODYNE_LSB for output 0,
+	// applied at the next update(). Single sideband output is up to
+	// 0.8 dB down at 1 kHz, the lower edge of the Hilbert FIR.
+	void sideband(int mode) {
+		if (mode != HETERODYNE_USB && mode != HETERODYNE_LSB) mode = HETERODYNE_DSB;
+		sideband_req = mode;
+	}
+	virtual void update(void);
+private:
+	struct cic_state {
+		uint32_t integrator[3]; // wrap around, only the comb output is used
+		uint32_t comb[3];
+	};
+	struct channel_state {
+		uint32_t phase_accumulator;
+		uint32_t phase_increment;
+		volatile uint32_t increment_target;
+		uint8_t decimate_count;
+		cic_state cic[2];       // I, and Q for single sideband
+		int32_t out_prev;       // last two decimated outputs
+		int32_t out_next;
+		int32_t droop[2];       // last two low-pass outputs, for the correction
+	};
+	void reset(void);
+	template <int mode> void mix(channel_state &ch, const int16_t *in, int16_t *out);
+	audio_block_t *inputQueueArray[1];
+	channel_state channel[2];
+	float sample_rate;
+	float lo_freq[2];
+	volatile int32_t magnitude;
+	uint8_t decimate_shift;     // decimation factor is 1 << decimate_shift
+	volatile uint8_t decimate_req;
+	uint8_t sideband_mode;
+	volatile uint8_t sideband_req;
+	// decimated I and Q history of output 0 for the Hilbert FIR, a power of 2
+	int32_t i_history[128];
+	int32_t q_history[128];
+	uint8_t history_pos;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Runs trains of synthetic calls of each species group through the bat
+// call detector and the classifier, set up like the sketch's: 256 points,
+// 50% overlap, Hann, 18 to 120 kHz and the gate, at two of its sample
+// rates. Every call of a train must be found once and given its group,
+// and the train must count as one pass.
+
+#include <stdio.h>
+#include <math.h>
+#include "analyze_batdetector.h"
+#include "bat_classifier.h"
+#include "host_util.h"
+
+#define CALLS        18
+#define LEARN_BLOCKS 1100    // half a second at 281 kHz
+#define NOISE_RMS    100
+
+static uint16_t bins[SPECTRUM_MAX_SIZE / 2];
+
+struct call_train {
+	uint8_t group;
+	host_call call;
+	double interval;    // ms
+};
+
+// typical calls of each group, amplitude 0.3 of full scale
+static const call_train trains[] = {
+	{ BATCLASS_NYCTALOID,        { 40000, 24000, 15.0, HOST_SWEEP_HYPERBOLIC, 0.3 }, 250 },
+	{ BATCLASS_MYOTIS,           { 90000, 30000, 4.0, HOST_SWEEP_LINEAR, 0.3 }, 80 },
+	{ BATCLASS_PIP_NATHUSII,     { 60000, 38000, 8.0, HOST_SWEEP_HYPERBOLIC, 0.3 }, 100 },
+	{ BATCLASS_PIP_PIPISTRELLUS, { 70000, 46000, 6.0, HOST_SWEEP_HYPERBOLIC, 0.3 }, 80 },
+	{ BATCLASS_PIP_PYGMAEUS,     { 80000, 55000, 6.0, HOST_SWEEP_HYPERBOLIC, 0.3 }, 80 },
+	{ BATCLASS_RHINO_FERRUM,     { 82000, 82000, 50.0, HOST_SWEEP_LINEAR, 0.3 }, 100 },
+	{ BATCLASS_RHINO_HIPPO,      { 110000, 110000, 40.0, HOST_SWEEP_LINEAR, 0.3 }, 100 },
+	// a constant frequency between the horseshoe bats fits no rule
+	{ BATCLASS_UNKNOWN,          { 95000, 95000, 40.0, HOST_SWEEP_LINEAR, 0.3 }, 100 },
+};
+
+static void test_train(const call_train &train, float rate)
+{
+	size_t first = LEARN_BLOCKS * AUDIO_BLOCK_SAMPLES;
+	size_t spacing = train.interval * rate / 1000;
+	std::vector<int16_t> input(first + (CALLS + 1) * spacing);
+	for (int i = 0; i < CALLS; i++) host_add_call(input, first + i * spacing, rate, train.call);
+	host_add_noise(input, NOISE_RMS, 5);
+
+	AudioAnalyzeBatDetector detector;
+	detector.setSampleRate(rate);
+	detector.configure(256, 50, SPECTRUM_WINDOW_HANN, bins);
+	detector.band(18000, 120000);
+	detector.gate(18000, 120000, 2.0, 100);
+	BatCallClassifier classifier;
+	int calls = 0;
+	for (size_t b = 0; b < input.size() / AUDIO_BLOCK_SAMPLES; b++) {
+		host_update(detector, &input[b * AUDIO_BLOCK_SAMPLES], NULL);
+		batcall_event ev;
+		while (detector.readEvent(&ev)) {
+			if (ev.type != BATCALL_END) continue;
+			calls++;
+			uint8_t group = classifier.classify(ev.features, ev.sample * 1000.0 / rate);
+			HOST_CHECK(group == train.group,
+				"%.0f kHz, %s call %d: %s, fchar %.0f Hz, %.2f ms, bandwidth %.0f Hz, %.2f kHz/ms, interval %.1f ms",
+				rate / 1000, BatCallClassifier::name(train.group), calls, BatCallClassifier::name(group),
+				ev.features.fchar, ev.features.duration, ev.features.bandwidth, ev.features.slope,
+				ev.features.interval);
+		}
+	}
+	printf("%5.1f kHz %-8s %2lu of %d calls, %lu pass\n", rate / 1000,
+		BatCallClassifier::name(train.group), (unsigned long)classifier.calls(train.group),
+		CALLS, (unsigned long)classifier.passes(train.group));
+	HOST_CHECK(calls == CALLS, "%.0f kHz, %s: %d calls for %d", rate / 1000,
+		BatCallClassifier::name(train.group), calls, CALLS);
+	HOST_CHECK(classifier.passes(train.group) == 1, "%.0f kHz, %s: %lu passes", rate / 1000,
+		BatCallClassifier::name(train.group), (unsigned long)classifier.passes(train.group));
+}
+
+int main(void)
+{
+	const float rates[2] = { 281000, 352800 };
+	for (int r = 0; r < 2; r++) {
+		for (unsigned int n = 0; n < sizeof(trains) / sizeof(trains[0]); n++) {
+			test_train(trains[n], rates[r]);
+		}
+	}
+	return host_result();
+}
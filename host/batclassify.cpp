@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Runs the sketch's bat call detector and species classifier over every
+// .raw recording in a directory and prints the calls per group of each
+// file, then the calls and passes per group of all of them. The detector
+// is set up like the sketch's: 256 points, 50% overlap, Hann, 18 to
+// 120 kHz and the gate. The sample rate comes from the name the sketch
+// gives a recording, e.g. B12_281.raw, or from -r.
+//
+//   batclassify [-r <sample rate>] <directory>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <algorithm>
+#include <string>
+#include "analyze_batdetector.h"
+#include "bat_classifier.h"
+#include "host_util.h"
+
+static uint16_t bins[SPECTRUM_MAX_SIZE / 2];
+
+// the sketch's SRtext at the end of the file name, 0 if there is none
+static float name_rate(const std::string &name)
+{
+	static const struct { const char *text; float rate; } rates[] = {
+		{ "8", 8000 }, { "11", 11025 }, { "16", 16000 }, { "22", 22050 },
+		{ "32", 32000 }, { "44", 44100 }, { "48", 48000 }, { "88k", 88200 },
+		{ "96", 96000 }, { "176", 176400 }, { "192", 192000 }, { "234", 234000 },
+		{ "281", 281000 }, { "352", 352800 },
+	};
+	size_t us = name.rfind('_');
+	size_t dot = name.rfind('.');
+	if (us == std::string::npos || dot == std::string::npos || dot < us) return 0;
+	std::string text = name.substr(us + 1, dot - us - 1);
+	while (!text.empty() && text[0] == ' ') text.erase(0, 1);
+	for (unsigned int n = 0; n < sizeof(rates) / sizeof(rates[0]); n++) {
+		if (text == rates[n].text) return rates[n].rate;
+	}
+	return 0;
+}
+
+// classifies the calls of one recording into file and into total, which
+// carries the time on from the previous recordings
+static bool run_file(const std::string &path, float rate, BatCallClassifier &file,
+	BatCallClassifier &total, uint32_t &ms)
+{
+	std::vector<int16_t> input;
+	if (!host_read_raw(path.c_str(), input)) return false;
+	AudioAnalyzeBatDetector detector;
+	detector.setSampleRate(rate);
+	detector.configure(256, 50, SPECTRUM_WINDOW_HANN, bins);
+	detector.band(18000, 120000);
+	detector.gate(18000, 120000, 2.0, 100);
+	uint32_t start_ms = ms;
+	size_t blocks = input.size() / AUDIO_BLOCK_SAMPLES;
+	for (size_t b = 0; b < blocks; b++) {
+		host_update(detector, &input[b * AUDIO_BLOCK_SAMPLES], NULL);
+		batcall_event ev;
+		while (detector.readEvent(&ev)) {
+			if (ev.type != BATCALL_END) continue;
+			uint32_t now = start_ms + (uint32_t)(ev.sample * 1000.0 / rate);
+			file.classify(ev.features, now);
+			total.classify(ev.features, now);
+		}
+	}
+	ms = start_ms + (uint32_t)(blocks * AUDIO_BLOCK_SAMPLES * 1000.0 / rate);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	float forced_rate = 0;
+	const char *dir_name = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) forced_rate = atof(argv[++i]);
+		else dir_name = argv[i];
+	}
+	if (!dir_name) {
+		fprintf(stderr, "usage: %s [-r <sample rate>] <directory>\n", argv[0]);
+		return 2;
+	}
+	DIR *dir = opendir(dir_name);
+	if (!dir) {
+		fprintf(stderr, "cannot open %s\n", dir_name);
+		return 1;
+	}
+	std::vector<std::string> names;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		std::string name = entry->d_name;
+		if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".raw") == 0) {
+			names.push_back(name);
+		}
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+
+	printf("%-20s %8s", "file", "kHz");
+	for (int g = 0; g < BATCLASS_COUNT; g++) printf(" %7s", BatCallClassifier::name(g));
+	printf("\n");
+	BatCallClassifier total;
+	uint32_t ms = 0;
+	for (size_t n = 0; n < names.size(); n++) {
+		float rate = forced_rate > 0 ? forced_rate : name_rate(names[n]);
+		if (rate <= 0) {
+			fprintf(stderr, "%s: no sample rate in the name, use -r\n", names[n].c_str());
+			continue;
+		}
+		BatCallClassifier file;
+		if (!run_file(std::string(dir_name) + "/" + names[n], rate, file, total, ms)) {
+			fprintf(stderr, "cannot read %s\n", names[n].c_str());
+			continue;
+		}
+		printf("%-20s %8.1f", names[n].c_str(), rate / 1000);
+		for (int g = 0; g < BATCLASS_COUNT; g++) printf(" %7lu", (unsigned long)file.calls(g));
+		printf("\n");
+	}
+	printf("%-20s %8s", "calls", "");
+	for (int g = 0; g < BATCLASS_COUNT; g++) printf(" %7lu", (unsigned long)total.calls(g));
+	printf("\n%-20s %8s", "passes", "");
+	for (int g = 0; g < BATCLASS_COUNT; g++) printf(" %7lu", (unsigned long)total.passes(g));
+	printf("\n");
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Tests of AudioAnalyzeBatDetector on synthetic calls at 281 kHz, 256
+// points, 50% overlap and a Hann window, the sketch's usual setup. The
+// detector first learns the noise floor from half a second of noise.
+
+#include <stdio.h>
+#include <math.h>
+#include "analyze_batdetector.h"
+#include "host_util.h"
+
+#define SAMPLE_RATE  281000
+#define LEARN_BLOCKS 1100    // half a second
+#define NOISE_RMS    100
+
+static uint16_t bins[SPECTRUM_MAX_SIZE / 2];
+
+// runs input through a detector set up like the sketch's and collects
+// its events
+static void run_detector(AudioAnalyzeBatDetector &detector, const std::vector<int16_t> &input,
+	std::vector<batcall_event> &events, int window = SPECTRUM_WINDOW_HANN)
+{
+	detector.setSampleRate(SAMPLE_RATE);
+	detector.band(20000, 120000);
+	detector.configure(256, 50, window, bins);
+	for (size_t b = 0; b < input.size() / AUDIO_BLOCK_SAMPLES; b++) {
+		host_update(detector, &input[b * AUDIO_BLOCK_SAMPLES], NULL);
+		batcall_event ev;
+		while (detector.readEvent(&ev)) events.push_back(ev);
+	}
+}
+
+// noise, then one call every 50 ms
+static std::vector<int16_t> call_train(const host_call *calls, int count)
+{
+	size_t spacing = SAMPLE_RATE / 20;
+	size_t first = LEARN_BLOCKS * AUDIO_BLOCK_SAMPLES;
+	std::vector<int16_t> input(first + (count + 1) * spacing);
+	for (int i = 0; i < count; i++) {
+		host_add_call(input, first + i * spacing, SAMPLE_RATE, calls[i]);
+	}
+	host_add_noise(input, NOISE_RMS, 3);
+	return input;
+}
+
+// Each call gives one start and one end event. The frames at the start
+// and the end of a call are averages over 0.9 ms of the sweep, so fstart
+// and fend may lie towards the middle of the call by 1.5 kHz plus what it
+// sweeps in 0.3 ms, and 1.5 kHz beyond its ends. The duration counts
+// whole hops of 0.46 ms and includes part of the frames that overlap the
+// edges. The slope comes from both.
+static void test_sweeps(void)
+{
+	const host_call calls[4] = {
+		{ 70000, 40000, 5.0, HOST_SWEEP_LINEAR, 0.3 },
+		{ 100000, 50000, 3.0, HOST_SWEEP_LINEAR, 0.3 },
+		{ 90000, 45000, 4.0, HOST_SWEEP_HYPERBOLIC, 0.3 },
+		{ 60000, 40000, 8.0, HOST_SWEEP_HYPERBOLIC, 0.3 },
+	};
+	std::vector<int16_t> input = call_train(calls, 4);
+	AudioAnalyzeBatDetector detector;
+	std::vector<batcall_event> events;
+	run_detector(detector, input, events);
+
+	HOST_CHECK(events.size() == 8, "%d events for 4 calls", (int)events.size());
+	if (events.size() != 8) return;
+	printf("%-20s %8s %8s %8s %8s %8s\n", "call", "fstart", "fend", "fchar", "ms", "kHz/ms");
+	for (int i = 0; i < 4; i++) {
+		const host_call &c = calls[i];
+		const batcall_event &start = events[i * 2];
+		const batcall_event &end = events[i * 2 + 1];
+		HOST_CHECK(start.type == BATCALL_START && end.type == BATCALL_END,
+			"call %d: events out of order", i);
+		const batcall_features &f = end.features;
+		printf("%3.0f-%3.0f kHz %s %8.0f %8.0f %8.0f %8.2f %8.2f\n", c.fstart / 1000, c.fend / 1000,
+			c.shape == HOST_SWEEP_LINEAR ? "lin" : "hyp",
+			f.fstart, f.fend, f.fchar, f.duration, f.slope);
+
+		double slope = (c.fstart - c.fend) * 0.001 / c.duration;
+		double inward = 1500 + slope * 1000 * 0.3;
+		HOST_CHECK(f.fstart < c.fstart + 1500 && f.fstart > c.fstart - inward,
+			"call %d: fstart %.0f Hz", i, f.fstart);
+		HOST_CHECK(f.fend > c.fend - 1500 && f.fend < c.fend + inward,
+			"call %d: fend %.0f Hz", i, f.fend);
+		HOST_CHECK(f.fpeak > c.fend - 1500 && f.fpeak < c.fstart + 1500,
+			"call %d: fpeak %.0f Hz", i, f.fpeak);
+		// a hyperbolic sweep is flattest at its end, a linear one has its
+		// smallest step into the last frame, which only holds the end
+		HOST_CHECK(fabs(f.fchar - f.fend) < 2000,
+			"call %d: fchar %.0f Hz, fend %.0f Hz", i, f.fchar, f.fend);
+		HOST_CHECK(fabs(f.duration - c.duration) < 1.0, "call %d: %.2f ms", i, f.duration);
+		HOST_CHECK(fabs(f.slope - slope) < 0.25 * slope, "call %d: slope %.2f kHz/ms, not %.2f",
+			i, f.slope, slope);
+		HOST_CHECK(f.bandwidth > 0.75 * (c.fstart - c.fend) && f.bandwidth < c.fstart - c.fend + 3000,
+			"call %d: bandwidth %.0f Hz", i, f.bandwidth);
+		HOST_CHECK(i == 0 || fabs(f.interval - 50.0) < 0.5, "call %d: interval %.2f ms", i, f.interval);
+		// the events give the centre of the first and the last frame,
+		// within half a frame of the call's ends
+		long onset = LEARN_BLOCKS * AUDIO_BLOCK_SAMPLES + i * (SAMPLE_RATE / 20);
+		long offset = onset + lrint(c.duration * SAMPLE_RATE / 1000);
+		HOST_CHECK(labs((long)start.sample - onset) <= 128, "call %d: start %ld samples off",
+			i, (long)start.sample - onset);
+		HOST_CHECK(labs((long)end.sample - offset) <= 128, "call %d: end %ld samples off",
+			i, (long)end.sample - offset);
+	}
+}
+
+// Horseshoe bats call at a constant frequency for most of the time: 50 ms
+// at 83 kHz every 80 ms. Each call must still start once after 5 s of
+// them, with the gate closing in the gaps or without a gate.
+static void test_cf_calls(bool gated)
+{
+	const int count = 62;
+	size_t period = SAMPLE_RATE * 80 / 1000;
+	size_t first = LEARN_BLOCKS * AUDIO_BLOCK_SAMPLES;
+	std::vector<int16_t> input(first + (count + 1) * period);
+	host_call call = { 83000, 83000, 50.0, HOST_SWEEP_LINEAR, 0.05 };
+	for (int i = 0; i < count; i++) host_add_call(input, first + i * period, SAMPLE_RATE, call);
+	host_add_noise(input, NOISE_RMS, 7);
+
+	AudioAnalyzeBatDetector detector;
+	if (gated) detector.gate(60000, 100000, 3.0, 20.0);
+	std::vector<batcall_event> events;
+	run_detector(detector, input, events);
+
+	// starts per second of calls, and whether the last second still has all
+	int starts = 0, late = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		if (events[i].type != BATCALL_START) continue;
+		starts++;
+		if (events[i].sample + period / 2 >= first + (count - 12) * period) late++;
+	}
+	printf("cf calls %s gate: %d starts for %d calls, %d of the last 12, floor %u\n",
+		gated ? "with" : "without", starts, count, late, detector.noiseFloor(83000 * 256 / SAMPLE_RATE));
+	HOST_CHECK(starts >= count && starts <= count + 2, "%d starts for %d calls", starts, count);
+	HOST_CHECK(late == 12, "%d of the last 12 calls started", late);
+}
+
+// A 4 ms linear sweep from 90 to 30 kHz spreads over 12 bins per frame,
+// so faint ones drop below the threshold for single frames. Each must
+// still be one call, not fragments of a frame or two.
+static void test_steep_sweeps(void)
+{
+	const int count = 18;
+	host_call calls[count];
+	for (int i = 0; i < count; i++) {
+		host_call c = { 90000, 30000, 4.0, HOST_SWEEP_LINEAR, 0.005 };
+		calls[i] = c;
+	}
+	std::vector<int16_t> input = call_train(calls, count);
+	AudioAnalyzeBatDetector detector;
+	std::vector<batcall_event> events;
+	run_detector(detector, input, events);
+	int ends = 0, short_calls = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		if (events[i].type != BATCALL_END) continue;
+		ends++;
+		if (events[i].features.duration < 2.0) short_calls++;
+	}
+	printf("steep sweeps: %d calls for %d, %d shorter than 2 ms\n", ends, count, short_calls);
+	HOST_CHECK(ends == count, "%d calls for %d steep sweeps", ends, count);
+	HOST_CHECK(short_calls == 0, "%d steep sweeps shorter than 2 ms", short_calls);
+}
+
+// A tone that goes on far longer than a call, e.g. from an electric
+// fence, is taken into the noise floor and stops being a call.
+static void test_steady_tone(void)
+{
+	size_t first = LEARN_BLOCKS * AUDIO_BLOCK_SAMPLES;
+	std::vector<int16_t> input(first + 4 * SAMPLE_RATE);
+	host_call tone = { 83000, 83000, 4000.0, HOST_SWEEP_LINEAR, 0.05 };
+	host_add_call(input, first, SAMPLE_RATE, tone);
+	host_add_noise(input, NOISE_RMS, 11);
+
+	AudioAnalyzeBatDetector detector;
+	std::vector<batcall_event> events;
+	run_detector(detector, input, events);
+	HOST_CHECK(events.size() == 2, "%d events for the tone", (int)events.size());
+	if (events.size() < 2) return;
+	double ms = (events[1].sample - first) * 1000.0 / SAMPLE_RATE;
+	printf("steady tone: a call of %.0f ms\n", ms);
+	HOST_CHECK(ms > BATDETECTOR_MAX_CALL && ms < 2000, "tone taken for a call of %.0f ms", ms);
+}
+
+// records the interpolated peak and the largest bin of every frame of a call
+class PeakRecorder : public AudioAnalyzeBatDetector
+{
+public:
+	struct frame {
+		uint32_t sample;
+		float refined;  // Hz
+		int bin;
+	};
+	std::vector<frame> frames;
+protected:
+	virtual void analyzed(const uint16_t *bins, uint32_t sample) {
+		AudioAnalyzeBatDetector::analyzed(bins, sample);
+		if (!inCall()) return;
+		frame f = { sample, peakFrequency(), 0 };
+		for (int i = 1; i < size / 2; i++) {
+			if (bins[i] > bins[f.bin]) f.bin = i;
+		}
+		frames.push_back(f);
+	}
+};
+
+// Tones from half a bin below to half a bin above bin 75, about 82 kHz, in
+// 1/16 bin steps. In every frame that lies inside a tone the peak between
+// the bins is compared with the largest bin alone, which is off by up to
+// half its 1.1 kHz. The window factor that would fit these tones best is
+// printed next to the one refinePeak() uses, to refit it after a change of
+// the windows.
+static void test_peak_accuracy(void)
+{
+	const char *window_name[3] = { "hann", "blackman-harris", "kaiser" };
+	const float factor[3] = { 2.0, 3.2, 2.4 }; // as in refinePeak()
+	const int steps = 17;
+	const double binwidth = SAMPLE_RATE / 256.0;
+	const size_t period = SAMPLE_RATE / 20, length = SAMPLE_RATE / 200;
+	const size_t first = LEARN_BLOCKS * AUDIO_BLOCK_SAMPLES;
+	printf("%-16s %10s %10s %10s %10s %8s\n", "window", "bin rms", "bin max",
+		"peak rms", "peak max", "fit");
+	for (int w = SPECTRUM_WINDOW_HANN; w <= SPECTRUM_WINDOW_KAISER; w++) {
+		std::vector<int16_t> input(first + (steps + 1) * period);
+		double freq[steps];
+		for (int i = 0; i < steps; i++) {
+			freq[i] = (75 + (i - 8) / 16.0) * binwidth;
+			host_call call = { freq[i], freq[i], length * 1000.0 / SAMPLE_RATE, HOST_SWEEP_LINEAR, 0.1 };
+			host_add_call(input, first + i * period, SAMPLE_RATE, call);
+		}
+		host_add_noise(input, NOISE_RMS, 13);
+		PeakRecorder detector;
+		std::vector<batcall_event> events;
+		run_detector(detector, input, events, w);
+
+		int count = 0;
+		double bin_sum = 0, bin_max = 0, peak_sum = 0, peak_max = 0;
+		double fit_num = 0, fit_den = 0;
+		for (size_t k = 0; k < detector.frames.size(); k++) {
+			const PeakRecorder::frame &f = detector.frames[k];
+			// frame centre at least half a frame and the 0.2 ms edge inside
+			size_t margin = 128 + SAMPLE_RATE / 5000;
+			if (f.sample < first + margin) continue;
+			int i = (f.sample - first) / period;
+			size_t at = (f.sample - first) % period;
+			if (i >= steps || at < margin || at + margin > length) continue;
+			double bin_error = f.bin * binwidth - freq[i];
+			double peak_error = f.refined - freq[i];
+			bin_sum += bin_error * bin_error;
+			peak_sum += peak_error * peak_error;
+			if (fabs(bin_error) > bin_max) bin_max = fabs(bin_error);
+			if (fabs(peak_error) > peak_max) peak_max = fabs(peak_error);
+			// offsets from the bin, as estimated and as they are
+			double estimate = f.refined / binwidth - f.bin;
+			double truth = freq[i] / binwidth - f.bin;
+			fit_num += estimate * truth;
+			fit_den += estimate * estimate;
+			count++;
+		}
+		HOST_CHECK(count >= steps * 5, "%s: %d frames inside the tones", window_name[w], count);
+		if (count == 0) continue;
+		double fit = fit_den > 0 ? factor[w] * fit_num / fit_den : 0;
+		bin_sum = sqrt(bin_sum / count);
+		peak_sum = sqrt(peak_sum / count);
+		printf("%-16s %10.0f %10.0f %10.0f %10.0f %8.2f\n", window_name[w],
+			bin_sum, bin_max, peak_sum, peak_max, fit);
+		HOST_CHECK(peak_max < 100, "%s: peak off by up to %.0f Hz", window_name[w], peak_max);
+		HOST_CHECK(peak_sum < bin_sum / 4, "%s: peak %.0f Hz rms, bin %.0f Hz rms",
+			window_name[w], peak_sum, bin_sum);
+		HOST_CHECK(fabs(fit - factor[w]) < 0.1 * factor[w], "%s: factor %.2f fits better than %.2f",
+			window_name[w], fit, factor[w]);
+	}
+}
+
+int main(void)
+{
+	test_sweeps();
+	test_cf_calls(false);
+	test_cf_calls(true);
+	test_steep_sweeps();
+	test_steady_tone();
+	test_peak_accuracy();
+	return host_result();
+}
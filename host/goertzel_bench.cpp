@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmark of AudioAnalyzeGoertzelBank against the FFT it replaces at
+// sites that watch a few frequencies. The bank runs 1 to 8 filters over a
+// window of 256 samples, the resolution of a 256 point FFT. The FFT is
+// AudioAnalyzeSpectrum at 256 points with a Hann window, standing in for
+// the audio library's AudioAnalyzeFFT256: at 50% overlap it also gives new
+// levels every block, at 0% every other block. The table gives ns and
+// cycles per block and the load at 281 kHz, each block's figure the
+// fastest of several runs. The FFT is the stub's Q15 one in plain C, on
+// the Teensy the CMSIS FFT with the DSP instructions may rank differently.
+
+#include <stdio.h>
+#include "analyze_goertzel.h"
+#include "analyze_spectrum.h"
+#include "host_util.h"
+
+#define SAMPLE_RATE  281000
+#define BLOCKS       256
+#define RUNS         20
+
+static uint16_t bins[SPECTRUM_MAX_SIZE / 2];
+
+static void report(const char *name, const host_profile &profile)
+{
+	double block_ns = 1e9 * AUDIO_BLOCK_SAMPLES / SAMPLE_RATE;
+	printf("%-20s %10.0f %10.0f %7.2f%%\n", name, profile.meanNs(), profile.meanCycles(),
+		100.0 * profile.meanNs() / block_ns);
+}
+
+int main(void)
+{
+	std::vector<int16_t> input(BLOCKS * AUDIO_BLOCK_SAMPLES);
+	for (int i = 0; i < 4; i++) {
+		host_call call = { 83000, 83000, 40.0, HOST_SWEEP_LINEAR, 0.3 };
+		host_add_call(input, (i * 64 + 4) * AUDIO_BLOCK_SAMPLES, SAMPLE_RATE, call);
+	}
+	host_add_noise(input, 200, 17);
+
+	printf("%-20s %10s %10s %8s\n", "node", "ns/block", "cycles", "load");
+	const int counts[4] = { 1, 2, 4, 8 };
+	for (int c = 0; c < 4; c++) {
+		host_profile profile;
+		for (int run = 0; run < RUNS; run++) {
+			AudioAnalyzeGoertzelBank bank;
+			bank.setSampleRate(SAMPLE_RATE);
+			bank.length(256);
+			for (int n = 0; n < counts[c]; n++) bank.frequency(n, 83000 + 9000 * n);
+			for (int b = 0; b < BLOCKS; b++) {
+				host_update(bank, &input[b * AUDIO_BLOCK_SAMPLES], NULL, &profile, b);
+			}
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "goertzel x%d", counts[c]);
+		report(name, profile);
+	}
+	const int overlaps[2] = { 50, 0 };
+	for (int o = 0; o < 2; o++) {
+		host_profile profile;
+		for (int run = 0; run < RUNS; run++) {
+			AudioAnalyzeSpectrum spectrum;
+			spectrum.configure(256, overlaps[o], SPECTRUM_WINDOW_HANN, bins);
+			for (int b = 0; b < BLOCKS; b++) {
+				host_update(spectrum, &input[b * AUDIO_BLOCK_SAMPLES], NULL, &profile, b);
+			}
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "fft 256, %d%%", overlaps[o]);
+		report(name, profile);
+	}
+	return host_result();
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmarks of AudioEffectGranular's block kernels.
+//
+// The time expansion playback kernels render one 128-sample block from a
+// recorded sweep at several playback rates, once per interpolation mode.
+// Each figure is the fastest of many runs.
+//
+// The pitch shift runs with the longest grain the bank holds. A grain
+// capture completes or the playback wraps every few dozen blocks, and no
+// block may cost much more than the typical one.
+//
+// Every grain_mode then runs at 352.8 kHz in both the node and its version
+// from before the per-mode kernels, on the same calls and commands.
+
+#include <stdio.h>
+#include "../effect_granular.cpp"
+#include "host_util.h"
+
+// the node as it was before update() was split into per-mode kernels
+#define AudioEffectGranular AudioEffectGranularUnsplit
+#include "reference/effect_granular.h"
+#undef AudioEffectGranular
+
+#define SAMPLE_RATE  281000
+#define BANK_SIZE    30000
+#define RUNS         2000
+
+static int16_t bank[BANK_SIZE];
+
+static const char *interp_name[4] = { "none", "linear", "hermite", "fir" };
+
+static void bench_te_kernels(void)
+{
+	std::vector<int16_t> sweep(BANK_SIZE);
+	host_call call = { 100000, 20000, 100.0, HOST_SWEEP_HYPERBOLIC, 0.8 };
+	host_add_call(sweep, 0, SAMPLE_RATE, call);
+	memcpy(bank, sweep.data(), sizeof(bank));
+
+	const float speeds[3] = { 0.05, 0.5, 1.0 };
+	int16_t out[AUDIO_BLOCK_SAMPLES];
+	printf("time expansion kernels, one %d-sample block\n", AUDIO_BLOCK_SAMPLES);
+	printf("%-8s %6s %10s %10s\n", "kernel", "speed", "ns", "cycles");
+	for (int k = 0; k < 4; k++) {
+		for (int s = 0; s < 3; s++) {
+			uint32_t rate = speeds[s] * 65536.0 + 0.499;
+			uint32_t pos = 1 << 16;
+			uint64_t best_ns = UINT64_MAX, best_cycles = UINT64_MAX;
+			for (int run = 0; run < RUNS; run++) {
+				if ((pos >> 16) + 200 >= BANK_SIZE - 2) pos = 1 << 16;
+				uint64_t c0 = host_cycles();
+				uint64_t t0 = host_ns();
+				int n = te_kernels[k](bank, out, AUDIO_BLOCK_SAMPLES, &pos, rate, BANK_SIZE - 2);
+				uint64_t t1 = host_ns();
+				uint64_t c1 = host_cycles();
+				HOST_CHECK(n == AUDIO_BLOCK_SAMPLES, "kernel %s rendered %d samples", interp_name[k], n);
+				if (t1 - t0 < best_ns) best_ns = t1 - t0;
+				if (c1 - c0 < best_cycles) best_cycles = c1 - c0;
+			}
+			printf("%-8s %6.2f %10llu %10llu\n", interp_name[k], speeds[s],
+				(unsigned long long)best_ns, (unsigned long long)best_cycles);
+		}
+	}
+}
+
+static void bench_pitch_shift(void)
+{
+	const int blocks = 600;
+	const int runs = 20;
+	std::vector<int16_t> input(blocks * AUDIO_BLOCK_SAMPLES);
+	for (int i = 0; i < 40; i++) {
+		host_call call = { 80000, 45000, 5.0, HOST_SWEEP_HYPERBOLIC, 0.5 };
+		host_add_call(input, i * 2000, SAMPLE_RATE, call);
+	}
+	host_add_noise(input, 200, 3);
+
+	printf("\npitch shift, %d blocks with a %d sample grain\n", blocks, (BANK_SIZE - 1) / 3);
+	printf("%6s %10s %10s %10s %8s\n", "speed", "median ns", "worst ns", "block", "ratio");
+	const float speeds[3] = { 0.5, 1.5, 2.0 };
+	for (int s = 0; s < 3; s++) {
+		host_profile profile;
+		for (int run = 0; run < runs; run++) {
+			AudioEffectGranular granular;
+			granular.begin(bank, BANK_SIZE);
+			granular.setSpeed(speeds[s]);
+			// longer than the bank allows, so the grain is as long as it gets
+			granular.beginPitchShift(1000.0);
+			int16_t out[AUDIO_BLOCK_SAMPLES];
+			for (int b = 0; b < blocks; b++) {
+				host_update(granular, &input[b * AUDIO_BLOCK_SAMPLES], out, &profile, b);
+			}
+		}
+		double ratio = profile.worstNs() / profile.medianNs();
+		printf("%6.2f %10.0f %10llu %10zu %8.2f\n", speeds[s], profile.medianNs(),
+			(unsigned long long)profile.worstNs(), profile.worstBlock(), ratio);
+		// copying the grains instead made single blocks 40 times the median
+		HOST_CHECK(ratio < 3.0, "pitch shift block %zu costs %.1f times the median",
+			profile.worstBlock(), ratio);
+	}
+}
+
+// the same setup for both versions of the node
+template <class granular_t>
+static void start_mode(granular_t &granular, int mode)
+{
+	switch (mode) {
+	case 1:
+		granular.setSpeed(1.0);
+		granular.beginFreeze(2.0);
+		break;
+	case 2:
+		granular.setSpeed(0.5);
+		granular.beginPitchShift(20.0);
+		break;
+	case 3:
+		granular.setInterpolation(GRANULAR_INTERP_HERMITE);
+		granular.setSpeed(0.06);
+		granular.beginTimeExpansion(BANK_SIZE);
+		break;
+	case 4:
+		granular.setdivider(10);
+		granular.beginDivider(1.0);
+		break;
+	}
+}
+
+template <class granular_t>
+static double run_mode(int mode, const std::vector<int16_t> &input)
+{
+	host_profile profile;
+	int blocks = input.size() / AUDIO_BLOCK_SAMPLES;
+	for (int run = 0; run < 20; run++) {
+		granular_t granular;
+		granular.begin(bank, BANK_SIZE);
+		int16_t out[AUDIO_BLOCK_SAMPLES];
+		for (int b = 0; b < blocks; b++) {
+			// requests follow the calls, like Auto_TE
+			if (b % 64 == 4) start_mode(granular, mode);
+			host_update(granular, &input[b * AUDIO_BLOCK_SAMPLES], out, &profile, b);
+		}
+	}
+	return profile.meanNs();
+}
+
+static void bench_modes(void)
+{
+	const int rate = 352800;
+	std::vector<int16_t> input(256 * AUDIO_BLOCK_SAMPLES);
+	for (int i = 0; i < 4; i++) {
+		host_call call = { 90000, 40000, 4.0, HOST_SWEEP_HYPERBOLIC, 0.5 };
+		host_add_call(input, (i * 64 + 4) * AUDIO_BLOCK_SAMPLES, rate, call);
+	}
+	host_add_noise(input, 200, 5);
+
+	const char *mode_name[5] = { "passthrough", "freeze", "pitchshift", "te_hermite", "divider" };
+	printf("\nper-mode kernels against the single update(), %d blocks at %d Hz\n",
+		(int)(input.size() / AUDIO_BLOCK_SAMPLES), rate);
+	printf("%-12s %10s %10s %8s\n", "mode", "before ns", "now ns", "ratio");
+	for (int mode = 0; mode < 5; mode++) {
+		double before = run_mode<AudioEffectGranularUnsplit>(mode, input);
+		double now = run_mode<AudioEffectGranular>(mode, input);
+		printf("%-12s %10.0f %10.0f %8.2f\n", mode_name[mode], before, now, now / before);
+	}
+}
+
+int main(void)
+{
+	bench_te_kernels();
+	bench_pitch_shift();
+	bench_modes();
+	return host_result();
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Unit tests of AudioEffectGranular's block kernels with the portable
+// versions of the DSP instructions, so they run on a PC.
+
+#include <stdio.h>
+#include "../effect_granular.cpp"
+#include "host_util.h"
+
+static void test_dsp_helpers(void)
+{
+	HOST_CHECK(te_saturate(40000) == 32767, "te_saturate(40000) is %d", te_saturate(40000));
+	HOST_CHECK(te_saturate(-40000) == -32768, "te_saturate(-40000) is %d", te_saturate(-40000));
+	HOST_CHECK(te_saturate(-1234) == -1234, "te_saturate(-1234) is %d", te_saturate(-1234));
+	int16_t a[2] = { -3, 1000 }, b[2] = { 7, -2000 };
+	int32_t sum = te_dual_mac(5, te_pair(a), te_pair(b));
+	HOST_CHECK(sum == 5 - 21 - 2000000, "te_dual_mac gives %d", sum);
+}
+
+// at integer positions every kernel returns the recorded samples, the FIR
+// within 1 LSB as its centre tap is 32767
+static void test_integer_positions(void)
+{
+	int16_t bank[200];
+	for (int i = 0; i < 200; i++) bank[i] = (i * 7919) % 60000 - 30000;
+	for (int k = 0; k < 4; k++) {
+		int16_t out[AUDIO_BLOCK_SAMPLES];
+		uint32_t pos = 1 << 16;
+		int n = te_kernels[k](bank, out, AUDIO_BLOCK_SAMPLES, &pos, 1 << 16, 198);
+		HOST_CHECK(n == AUDIO_BLOCK_SAMPLES, "kernel %d rendered %d samples", k, n);
+		int errors = 0;
+		int tolerance = (k == GRANULAR_INTERP_FIR) ? 1 : 0;
+		for (int i = 0; i < n; i++) {
+			if (abs(out[i] - bank[i + 1]) > tolerance) errors++;
+		}
+		HOST_CHECK(errors == 0, "kernel %d changed %d samples at integer positions", k, errors);
+		HOST_CHECK(pos == (uint32_t)(1 + AUDIO_BLOCK_SAMPLES) << 16, "kernel %d ends at %08x", k, pos);
+	}
+}
+
+// linear and Hermite interpolation reproduce a ramp between the samples
+static void test_ramp(void)
+{
+	int16_t bank[64];
+	for (int i = 0; i < 64; i++) bank[i] = i * 400 - 12000;
+	for (int k = GRANULAR_INTERP_LINEAR; k <= GRANULAR_INTERP_HERMITE; k++) {
+		int16_t out[AUDIO_BLOCK_SAMPLES];
+		uint32_t pos = 1 << 16;
+		uint32_t rate = 0x3000; // 3/16
+		int n = te_kernels[k](bank, out, AUDIO_BLOCK_SAMPLES, &pos, rate, 60);
+		int worst = 0;
+		for (int i = 0; i < n; i++) {
+			double expected = 400.0 * (1.0 + i * 3.0 / 16.0) - 12000;
+			int diff = abs(out[i] - (int)lrint(expected));
+			if (diff > worst) worst = diff;
+		}
+		HOST_CHECK(worst <= 1, "kernel %d is %d off the ramp", k, worst);
+	}
+}
+
+// a slow sine played at 1/16 speed stays close to the true sine, and
+// truncation is the worst of the kernels
+static void test_sine(void)
+{
+	int16_t bank[AUDIO_BLOCK_SAMPLES];
+	double w = 2.0 * M_PI / 16;
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) bank[i] = lrint(20000 * sin(w * i));
+	double rms[4];
+	for (int k = 0; k < 4; k++) {
+		int16_t out[AUDIO_BLOCK_SAMPLES];
+		uint32_t pos = 1 << 16;
+		int n = te_kernels[k](bank, out, AUDIO_BLOCK_SAMPLES, &pos, 1 << 12, 100);
+		double sum = 0;
+		for (int i = 0; i < n; i++) {
+			double e = out[i] - 20000 * sin(w * (1 + i / 16.0));
+			sum += e * e;
+		}
+		rms[k] = sqrt(sum / n);
+	}
+	HOST_CHECK(rms[GRANULAR_INTERP_LINEAR] < 300, "linear error %.0f", rms[GRANULAR_INTERP_LINEAR]);
+	HOST_CHECK(rms[GRANULAR_INTERP_HERMITE] < 30, "hermite error %.0f", rms[GRANULAR_INTERP_HERMITE]);
+	HOST_CHECK(rms[GRANULAR_INTERP_FIR] < 200, "fir error %.0f", rms[GRANULAR_INTERP_FIR]);
+	for (int k = 1; k < 4; k++) {
+		HOST_CHECK(rms[k] < rms[GRANULAR_INTERP_NONE], "kernel %d error %.0f, truncation %.0f",
+			k, rms[k], rms[GRANULAR_INTERP_NONE]);
+	}
+}
+
+// the kernels stop at limit and say how far they got
+static void test_limit(void)
+{
+	int16_t bank[64] = { 0 };
+	for (int k = 0; k < 4; k++) {
+		int16_t out[AUDIO_BLOCK_SAMPLES];
+		uint32_t pos = 10 << 16;
+		int n = te_kernels[k](bank, out, AUDIO_BLOCK_SAMPLES, &pos, 0x8000, 20);
+		HOST_CHECK(n == 20, "kernel %d rendered %d samples up to the limit", k, n);
+		HOST_CHECK((pos >> 16) == 20, "kernel %d stopped at %u", k, pos >> 16);
+		n = te_kernels[k](bank, out, AUDIO_BLOCK_SAMPLES, &pos, 0x8000, 20);
+		HOST_CHECK(n == 0, "kernel %d rendered %d samples past the limit", k, n);
+	}
+}
+
+// the divider kernels turn a 40 kHz tone into 4 kHz at divider 10
+static void test_divider(void)
+{
+	for (int shape = GRANULAR_DIVIDER_SQUARE; shape <= GRANULAR_DIVIDER_SHAPED; shape++) {
+		static int16_t memory[1024];
+		AudioEffectGranular granular;
+		granular.begin(memory, 1024);
+		granular.setdivider(10);
+		granular.setDividerShape(shape);
+		granular.beginDivider(1.0);
+		const double rate = 281000;
+		const int blocks = 220; // 0.1 s
+		int crossings = 0;
+		int16_t prev = 0;
+		for (int b = 0; b < blocks; b++) {
+			int16_t in[AUDIO_BLOCK_SAMPLES], out[AUDIO_BLOCK_SAMPLES];
+			for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+				in[i] = lrint(16000 * sin(2 * M_PI * 40000 / rate * (b * AUDIO_BLOCK_SAMPLES + i)));
+			}
+			host_update(granular, in, out);
+			for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+				if ((out[i] < 0) != (prev < 0)) crossings++;
+				prev = out[i];
+			}
+		}
+		// 4 kHz has 8000 crossings per second, the envelope takes a few
+		double freq = crossings / 2.0 / (blocks * AUDIO_BLOCK_SAMPLES / rate);
+		HOST_CHECK(fabs(freq - 4000) < 100, "divider shape %d gives %.0f Hz", shape, freq);
+	}
+}
+
+int main(void)
+{
+	test_dsp_helpers();
+	test_integer_positions();
+	test_ramp();
+	test_sine();
+	test_limit();
+	test_divider();
+	return host_result();
+}
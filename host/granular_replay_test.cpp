@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Replays command sequences from the sketch into AudioEffectGranular and
+// checks that they take effect together at the next block boundary.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include "effect_granular.h"
+#include "host_util.h"
+
+#define SAMPLE_RATE  281000
+#define MEMORY_SIZE  30000
+
+static int16_t memory[MEMORY_SIZE];
+
+// calls every 20 ms in noise, so there are zero crossings to start on
+static std::vector<int16_t> make_input(int blocks)
+{
+	std::vector<int16_t> input(blocks * AUDIO_BLOCK_SAMPLES);
+	for (size_t at = 256; at < input.size(); at += SAMPLE_RATE / 50) {
+		host_call call = { 70000, 40000, 5.0, HOST_SWEEP_HYPERBOLIC, 0.5 };
+		host_add_call(input, at, SAMPLE_RATE, call);
+	}
+	host_add_noise(input, 300, 7);
+	return input;
+}
+
+static bool same(const int16_t *a, const int16_t *b)
+{
+	return memcmp(a, b, AUDIO_BLOCK_SAMPLES * sizeof(int16_t)) == 0;
+}
+
+static bool silent(const int16_t *a)
+{
+	for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		if (a[i]) return false;
+	}
+	return true;
+}
+
+// commands posted between two blocks all apply before the second one
+static void test_block_boundary(void)
+{
+	std::vector<int16_t> input = make_input(4);
+	int16_t out[AUDIO_BLOCK_SAMPLES];
+	AudioEffectGranular granular;
+	granular.begin(memory, MEMORY_SIZE);
+
+	granular.setSpeed(0.5);
+	granular.beginPitchShift(20.0);
+	granular.stop();
+	host_update(granular, &input[0], out);
+	HOST_CHECK(same(out, &input[0]), "pitch shift and stop in one block is not passthrough");
+
+	granular.beginPitchShift(20.0);
+	host_update(granular, &input[AUDIO_BLOCK_SAMPLES], out);
+	HOST_CHECK(silent(out), "pitch shift plays before its first grain");
+
+	// only time expansion listens to its stop
+	granular.stopTimeExpansion();
+	host_update(granular, &input[2 * AUDIO_BLOCK_SAMPLES], out);
+	HOST_CHECK(silent(out), "stopTimeExpansion() ended the pitch shift");
+}
+
+// Freeze passes the input through while it records its grain, pitch
+// shift is silent until its first grain. A switch half way through the
+// freeze capture changes the output exactly at the block it was posted for.
+static void test_switch_mid_capture(void)
+{
+	const int blocks = 40;
+	std::vector<int16_t> input = make_input(blocks);
+	int16_t out[AUDIO_BLOCK_SAMPLES];
+	AudioEffectGranular granular;
+	granular.begin(memory, MEMORY_SIZE);
+	granular.setSpeed(1.0);
+	// 8823 samples, about 69 blocks of capture
+	granular.beginFreeze(200.0);
+	for (int b = 0; b < blocks; b++) {
+		const int16_t *in = &input[b * AUDIO_BLOCK_SAMPLES];
+		if (b == 20) {
+			granular.setSpeed(0.5);
+			granular.beginPitchShift(20.0);
+		}
+		host_update(granular, in, out);
+		if (b < 20) {
+			HOST_CHECK(same(out, in), "freeze block %d is not the input", b);
+		} else if (b == 20) {
+			HOST_CHECK(silent(out), "pitch shift block %d is not silent", b);
+		}
+	}
+	// the pitch shift has had time to capture and play
+	HOST_CHECK(!silent(out), "pitch shift still silent after %d blocks", blocks - 20);
+}
+
+// the mailbox holds 15 commands, the 16th is dropped
+static void test_full_mailbox(void)
+{
+	std::vector<int16_t> input = make_input(2);
+	int16_t out[AUDIO_BLOCK_SAMPLES];
+
+	for (int queued = 14; queued <= 15; queued++) {
+		AudioEffectGranular granular;
+		granular.begin(memory, MEMORY_SIZE);
+		for (int i = 0; i < queued; i++) granular.setSpeed(0.5);
+		granular.beginPitchShift(20.0);
+		host_update(granular, &input[0], out);
+		if (queued == 14) {
+			HOST_CHECK(silent(out), "the 15th command was dropped");
+		} else {
+			HOST_CHECK(same(out, &input[0]), "the 16th command was not dropped");
+		}
+		// the mailbox is empty again after the block
+		granular.beginPitchShift(20.0);
+		host_update(granular, &input[AUDIO_BLOCK_SAMPLES], out);
+		HOST_CHECK(silent(out), "mailbox still full after a block");
+	}
+}
+
+// setBanks() during time expansion playback drops the queued calls; the
+// next request records and plays again
+static void test_banks_during_playback(void)
+{
+	const int blocks = 200;
+	std::vector<int16_t> input = make_input(blocks);
+	int16_t out[AUDIO_BLOCK_SAMPLES];
+	AudioEffectGranular granular;
+	granular.begin(memory, MEMORY_SIZE);
+	granular.setBanks(2);
+	granular.setInterpolation(GRANULAR_INTERP_HERMITE);
+	granular.setSpeed(0.06);
+	int played_after = 0;
+	for (int b = 0; b < blocks; b++) {
+		if (b == 3 || b == 50 || b == 120) granular.beginTimeExpansion(MEMORY_SIZE);
+		if (b == 30 || b == 80 || b == 150) granular.stopTimeExpansion();
+		if (b == 100) {
+			HOST_CHECK(granular.queuedCalls() == 2, "%d calls queued before setBanks()",
+				granular.queuedCalls());
+			granular.setBanks(1);
+		}
+		host_update(granular, &input[b * AUDIO_BLOCK_SAMPLES], out);
+		if (b == 100) {
+			HOST_CHECK(granular.queuedCalls() == 0, "%d calls queued after setBanks()",
+				granular.queuedCalls());
+		}
+		if (b > 100 && b < 120) {
+			HOST_CHECK(silent(out), "block %d plays a call from before setBanks()", b);
+		}
+		if (b > 120 && !silent(out)) played_after++;
+	}
+	HOST_CHECK(played_after > 0, "nothing played after setBanks()");
+	HOST_CHECK(granular.droppedCalls() == 0, "%u calls dropped", granular.droppedCalls());
+}
+
+// GRANULAR_MAX_BANKS + 2 requests while the first call still plays: each
+// records a tone of its own, the last two find every bank busy and are
+// dropped, and the queued tones play in the order they were requested.
+// Playback at speed 0.1 brings the tones down to 2 to 5 kHz.
+static void test_requests_past_banks(void)
+{
+	const int requests = GRANULAR_MAX_BANKS + 2, spacing = 60, first = 10;
+	const int blocks = 2600, window = 2048;
+	std::vector<int16_t> input(blocks * AUDIO_BLOCK_SAMPLES);
+	double tone[requests];
+	for (int r = 0; r < requests; r++) {
+		tone[r] = 20000 + 10000 * r;
+		host_call call = { tone[r], tone[r], spacing * AUDIO_BLOCK_SAMPLES * 1000.0 / SAMPLE_RATE,
+			HOST_SWEEP_LINEAR, 0.5 };
+		host_add_call(input, (first + r * spacing) * AUDIO_BLOCK_SAMPLES, SAMPLE_RATE, call);
+	}
+	AudioEffectGranular granular;
+	granular.begin(memory, MEMORY_SIZE);
+	granular.setBanks(GRANULAR_MAX_BANKS);
+	granular.setSpeed(0.1);
+	std::vector<int16_t> output(blocks * AUDIO_BLOCK_SAMPLES);
+	for (int b = 0; b < blocks; b++) {
+		if (b >= first && (b - first) % spacing == 0 && b < first + requests * spacing) {
+			granular.beginTimeExpansion(MEMORY_SIZE);
+		}
+		host_update(granular, &input[b * AUDIO_BLOCK_SAMPLES], &output[b * AUDIO_BLOCK_SAMPLES]);
+		if (b == first + requests * spacing) {
+			HOST_CHECK(granular.queuedCalls() == GRANULAR_MAX_BANKS, "%d calls queued",
+				granular.queuedCalls());
+		}
+	}
+	HOST_CHECK(granular.droppedCalls() == requests - GRANULAR_MAX_BANKS, "%u calls dropped, not %d",
+		granular.droppedCalls(), requests - GRANULAR_MAX_BANKS);
+	HOST_CHECK(granular.queuedCalls() == 0, "%d calls still queued at the end",
+		granular.queuedCalls());
+
+	// the tone of each window of output from its zero crossings, and the
+	// order in which the tones start
+	std::vector<int> order;
+	for (size_t at = 0; at + window <= output.size(); at += window) {
+		int crossings = 0, loud = 0;
+		for (int i = 1; i < window; i++) {
+			if ((output[at + i] < 0) != (output[at + i - 1] < 0)) crossings++;
+			if (abs(output[at + i]) > 4000) loud++;
+		}
+		if (loud < window / 4) continue;
+		double freq = crossings / 2.0 * SAMPLE_RATE / window;
+		int nearest = 0;
+		for (int r = 1; r < requests; r++) {
+			if (fabs(freq - 0.1 * tone[r]) < fabs(freq - 0.1 * tone[nearest])) nearest = r;
+		}
+		if (order.empty() || order.back() != nearest) order.push_back(nearest);
+	}
+	bool in_order = order.size() == GRANULAR_MAX_BANKS;
+	for (size_t i = 0; in_order && i < order.size(); i++) in_order = order[i] == (int)i;
+	std::string played;
+	for (size_t i = 0; i < order.size(); i++) played += " " + std::to_string(order[i]);
+	HOST_CHECK(in_order, "the queued calls played as requests%s", played.c_str());
+}
+
+// Overlap-add shift up by 8 with the longest grain, asked for before and
+// while the shift runs, on a slow ramp. Every grain reads a stretch of the
+// ramp and the windows blend them smoothly. A grain that read past the
+// write head would jump back to ring contents from a ring length ago.
+static void test_overlap_speed(void)
+{
+	const int blocks = 300;
+	std::vector<int16_t> input(blocks * AUDIO_BLOCK_SAMPLES);
+	for (size_t i = 0; i < input.size(); i++) input[i] = i / 4 - 10000;
+	for (int late = 0; late <= 1; late++) {
+		AudioEffectGranular granular;
+		granular.begin(memory, 4096);
+		if (!late) granular.setSpeed(8.0);
+		granular.setOverlap(4, GRANULAR_WINDOW_HANN);
+		granular.beginOverlapShift(1000.0);
+		int worst = 0;
+		int16_t prev = 0;
+		for (int b = 0; b < blocks; b++) {
+			if (late && b == 50) granular.setSpeed(8.0);
+			int16_t out[AUDIO_BLOCK_SAMPLES];
+			host_update(granular, &input[b * AUDIO_BLOCK_SAMPLES], out);
+			// after the ring filled and the grains restarted at speed 8
+			for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+				if (b >= 100 && abs(out[i] - prev) > worst) worst = abs(out[i] - prev);
+				prev = out[i];
+			}
+		}
+		HOST_CHECK(worst < 20, "speed 8 %s the start: the output jumps by %d",
+			late ? "after" : "before", worst);
+	}
+}
+
+// A call starts 10 samples into block 300 over noise of several levels and
+// time expansion is requested at block 304, about 500 samples later. The
+// request either enters time expansion from passthrough or comes while it
+// already runs. The onset is where the call's 0.2 ms rising edge crosses
+// the threshold, up to 60 samples after its start.
+static void test_trigger_latency(void)
+{
+	const int blocks = 320, onset = 300 * AUDIO_BLOCK_SAMPLES + 10;
+	const int expected = 304 * AUDIO_BLOCK_SAMPLES - onset;
+	const double levels[5] = { 0, 100, 200, 400, 800 };
+	for (int entering = 0; entering < 2; entering++) {
+		for (int n = 0; n < 5; n++) {
+			std::vector<int16_t> input(blocks * AUDIO_BLOCK_SAMPLES);
+			host_call call = { 60000, 40000, 5.0, HOST_SWEEP_HYPERBOLIC, 0.5 };
+			host_add_call(input, onset, SAMPLE_RATE, call);
+			host_add_noise(input, levels[n], 19);
+			int16_t out[AUDIO_BLOCK_SAMPLES];
+			AudioEffectGranular granular;
+			granular.begin(memory, MEMORY_SIZE);
+			if (!entering) granular.beginTimeExpansion(20.0);
+			for (int b = 0; b < blocks; b++) {
+				if (b == 304) {
+					if (!entering) granular.stopTimeExpansion();
+					granular.beginTimeExpansion(20.0);
+				}
+				host_update(granular, &input[b * AUDIO_BLOCK_SAMPLES], out);
+			}
+			int32_t latency = granular.triggerLatency();
+			HOST_CHECK(latency <= expected && latency > expected - 60,
+				"noise rms %.0f, %s: latency %ld, not %d",
+				levels[n], entering ? "entering" : "in time expansion", (long)latency, expected);
+		}
+	}
+}
+
+// Time expansion from a bank split over three uneven segments plays the
+// same samples as from one contiguous bank, for 1 to 3 banks and every
+// interpolation. The segment edges at 7001 and 20000 fall inside banks or
+// on a bank edge, and playback at a fractional speed passes every
+// position, so some kernel windows straddle an edge.
+static void test_segmented_bank(void)
+{
+	static int16_t seg0[7001], seg1[12999], seg2[10000];
+	int16_t *segments[3] = { seg0, seg1, seg2 };
+	const int32_t lengths[3] = { 7001, 12999, 10000 };
+	const int blocks = 1200;
+	std::vector<int16_t> input = make_input(blocks);
+	for (int banks = 1; banks <= 3; banks++) {
+		for (int k = GRANULAR_INTERP_NONE; k <= GRANULAR_INTERP_FIR; k++) {
+			AudioEffectGranular whole, split;
+			whole.begin(memory, MEMORY_SIZE);
+			split.begin(segments, lengths, 3);
+			AudioEffectGranular *nodes[2] = { &whole, &split };
+			for (int i = 0; i < 2; i++) {
+				nodes[i]->setBanks(banks);
+				nodes[i]->setInterpolation(k);
+				nodes[i]->setSpeed(0.37);
+				nodes[i]->setPreTrigger(2000);
+			}
+			int differ = -1, played = 0;
+			for (int b = 0; b < blocks; b++) {
+				for (int i = 0; i < 2; i++) {
+					if (b == 40 || b == 130 || b == 220) nodes[i]->beginTimeExpansion(MEMORY_SIZE);
+				}
+				int16_t out_whole[AUDIO_BLOCK_SAMPLES], out_split[AUDIO_BLOCK_SAMPLES];
+				const int16_t *in = &input[b * AUDIO_BLOCK_SAMPLES];
+				host_update(whole, in, out_whole);
+				host_update(split, in, out_split);
+				if (differ < 0 && !same(out_whole, out_split)) differ = b;
+				if (!silent(out_whole)) played++;
+			}
+			HOST_CHECK(differ < 0, "%d banks, interpolation %d: segmented output differs from block %d",
+				banks, k, differ);
+			HOST_CHECK(played > 600, "%d banks, interpolation %d: only %d blocks played",
+				banks, k, played);
+			HOST_CHECK(whole.droppedCalls() == split.droppedCalls(),
+				"%d banks: %u and %u calls dropped", banks,
+				whole.droppedCalls(), split.droppedCalls());
+		}
+	}
+}
+
+int main(void)
+{
+	test_block_boundary();
+	test_switch_mid_capture();
+	test_full_mailbox();
+	test_banks_during_playback();
+	test_requests_past_banks();
+	test_overlap_speed();
+	test_trigger_latency();
+	test_segmented_bank();
+	return host_result();
+}
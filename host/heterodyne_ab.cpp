@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// A/B comparison of the heterodyne output on a recording: A is the
+// sketch's old chain, a sine oscillator at half scale into a multiply with
+// no filter after it, B is AudioEffectHeterodyne. Both outputs are written
+// as .raw files to listen to, and their levels below and above 20 kHz
+// are printed.
+//
+//   heterodyne_ab <recording.raw> <sample rate> <oscillator Hz> <output prefix> [dsb|usb|lsb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "effect_heterodyne.h"
+#include "host_util.h"
+
+#define SPLIT_FREQ   20000.0
+#define SPLIT_TAPS   255
+
+// rms of the whole signal and of the part below SPLIT_FREQ, from a
+// Blackman windowed sinc low-pass
+static void levels(const std::vector<int16_t> &x, double rate, double *audible, double *ultrasonic)
+{
+	double taps[SPLIT_TAPS];
+	double fc = SPLIT_FREQ / rate;
+	for (int k = 0; k < SPLIT_TAPS; k++) {
+		int n = k - SPLIT_TAPS / 2;
+		double sinc = n ? sin(2 * M_PI * fc * n) / (M_PI * n) : 2 * fc;
+		double w = 0.42 - 0.5 * cos(2 * M_PI * k / (SPLIT_TAPS - 1)) + 0.08 * cos(4 * M_PI * k / (SPLIT_TAPS - 1));
+		taps[k] = sinc * w;
+	}
+	double low = 0, high = 0;
+	size_t count = 0;
+	for (size_t i = SPLIT_TAPS; i < x.size(); i++) {
+		double y = 0;
+		for (int k = 0; k < SPLIT_TAPS; k++) y += taps[k] * x[i - k];
+		double rest = x[i - SPLIT_TAPS / 2] - y;
+		low += y * y;
+		high += rest * rest;
+		count++;
+	}
+	*audible = count ? sqrt(low / count) : 0;
+	*ultrasonic = count ? sqrt(high / count) : 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s <recording.raw> <sample rate> <oscillator Hz> <output prefix> [dsb|usb|lsb]\n", argv[0]);
+		return 2;
+	}
+	std::vector<int16_t> input;
+	if (!host_read_raw(argv[1], input)) {
+		fprintf(stderr, "cannot read %s\n", argv[1]);
+		return 1;
+	}
+	double rate = atof(argv[2]);
+	double lo = atof(argv[3]);
+	int sideband = HETERODYNE_DSB;
+	if (argc > 5 && !strcmp(argv[5], "usb")) sideband = HETERODYNE_USB;
+	else if (argc > 5 && !strcmp(argv[5], "lsb")) sideband = HETERODYNE_LSB;
+	input.resize(input.size() / AUDIO_BLOCK_SAMPLES * AUDIO_BLOCK_SAMPLES);
+
+	// A: sine oscillator at 0.5 times the input, saturated Q15 product
+	std::vector<int16_t> a(input.size());
+	for (size_t i = 0; i < input.size(); i++) {
+		int32_t osc = lrint(16384 * sin(2 * M_PI * lo / rate * i));
+		int32_t val = (input[i] * osc) >> 15;
+		if (val > 32767) val = 32767;
+		else if (val < -32768) val = -32768;
+		a[i] = val;
+	}
+
+	// B: the fused node, with its default amplitude of 0.5
+	std::vector<int16_t> b(input.size());
+	AudioEffectHeterodyne heterodyne;
+	heterodyne.setSampleRate(rate);
+	heterodyne.frequency(lo);
+	heterodyne.sideband(sideband);
+	host_profile profile;
+	for (size_t i = 0; i < input.size(); i += AUDIO_BLOCK_SAMPLES) {
+		host_update(heterodyne, &input[i], &b[i], &profile, i / AUDIO_BLOCK_SAMPLES);
+	}
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s_a.raw", argv[4]);
+	if (!host_write_raw(path, a.data(), a.size())) fprintf(stderr, "cannot write %s\n", path);
+	snprintf(path, sizeof(path), "%s_b.raw", argv[4]);
+	if (!host_write_raw(path, b.data(), b.size())) fprintf(stderr, "cannot write %s\n", path);
+
+	double audible, ultrasonic;
+	printf("%.0f samples at %.0f Hz, oscillator %.0f Hz\n", (double)input.size(), rate, lo);
+	printf("%-14s %12s %12s\n", "", "< 20 kHz rms", "> 20 kHz rms");
+	levels(a, rate, &audible, &ultrasonic);
+	printf("%-14s %12.1f %12.1f\n", "A sine*mult", audible, ultrasonic);
+	levels(b, rate, &audible, &ultrasonic);
+	printf("%-14s %12.1f %12.1f\n", "B heterodyne", audible, ultrasonic);
+	printf("B takes %.0f ns per block on this machine\n", profile.meanNs());
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmark of AudioEffectHeterodyne at the sketch's high sample rates.
+//
+// Each sideband mode mixes a train of synthetic calls at 192, 281 and
+// 352.8 kHz. The table gives the time of one 128-sample block, the worst
+// block, and how many times faster than real time the node runs, e.g. 40
+// means one block takes a 40th of the time it lasts at that rate. Each
+// block's figure is the fastest of several runs.
+
+#include <stdio.h>
+#include "effect_heterodyne.h"
+#include "host_util.h"
+
+#define BLOCKS  256
+#define RUNS    20
+#define LO_FREQ 45000.0
+
+static const char *sideband_name[3] = { "dsb", "usb", "lsb" };
+
+static void bench_rate(double rate)
+{
+	std::vector<int16_t> input(BLOCKS * AUDIO_BLOCK_SAMPLES);
+	for (int i = 0; i < 4; i++) {
+		host_call call = { 90000, 40000, 4.0, HOST_SWEEP_HYPERBOLIC, 0.5 };
+		host_add_call(input, (i * 64 + 4) * AUDIO_BLOCK_SAMPLES, rate, call);
+	}
+	host_add_noise(input, 200, 5);
+	double block_ns = 1e9 * AUDIO_BLOCK_SAMPLES / rate;
+
+	for (int mode = HETERODYNE_DSB; mode <= HETERODYNE_LSB; mode++) {
+		host_profile profile;
+		int16_t out[AUDIO_BLOCK_SAMPLES];
+		for (int run = 0; run < RUNS; run++) {
+			AudioEffectHeterodyne heterodyne;
+			heterodyne.setSampleRate(rate);
+			heterodyne.frequency(LO_FREQ);
+			heterodyne.sideband(mode);
+			for (int b = 0; b < BLOCKS; b++) {
+				host_update(heterodyne, &input[b * AUDIO_BLOCK_SAMPLES], out, &profile, b);
+			}
+		}
+		printf("%8.1f %-4s %10.0f %10llu %10.0f %10.1f\n", rate / 1000, sideband_name[mode],
+			profile.meanNs(), (unsigned long long)profile.worstNs(),
+			profile.meanCycles(), block_ns / profile.meanNs());
+	}
+}
+
+int main(void)
+{
+	printf("%8s %-4s %10s %10s %10s %10s\n", "kHz", "mode", "ns/block", "worst ns", "cycles", "x realtime");
+	bench_rate(192000);
+	bench_rate(281000);
+	bench_rate(352800);
+	return host_result();
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Tests of AudioEffectHeterodyne: the level of the audible difference
+// tone across the passband and the rejection of the opposite sideband,
+// at the sketch's high sample rates.
+
+#include <stdio.h>
+#include <math.h>
+#include "effect_heterodyne.h"
+#include "host_util.h"
+
+#define LO_FREQ  45000.0
+
+// level of the difference tone, |freq - LO_FREQ|, in the output for an
+// input tone at freq, after the filters settled. A Hann windowed single
+// bin DFT leaves out the other mixing products and their aliases.
+static double tone_level(double rate, double freq, int sideband)
+{
+	AudioEffectHeterodyne heterodyne;
+	heterodyne.setSampleRate(rate);
+	heterodyne.frequency(LO_FREQ);
+	heterodyne.sideband(sideband);
+	const int settle = 20, blocks = 200;
+	const int length = (blocks - settle) * AUDIO_BLOCK_SAMPLES;
+	double w = 2 * M_PI * fabs(freq - LO_FREQ) / rate;
+	double re = 0, im = 0;
+	for (int b = 0; b < blocks; b++) {
+		int16_t in[AUDIO_BLOCK_SAMPLES], out[AUDIO_BLOCK_SAMPLES];
+		for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+			in[i] = lrint(16000 * sin(2 * M_PI * freq / rate * (b * AUDIO_BLOCK_SAMPLES + i)));
+		}
+		host_update(heterodyne, in, out);
+		if (b < settle) continue;
+		for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+			int n = (b - settle) * AUDIO_BLOCK_SAMPLES + i;
+			double hann = 0.5 - 0.5 * cos(2 * M_PI * n / length);
+			re += hann * out[i] * cos(w * n);
+			im += hann * out[i] * sin(w * n);
+		}
+	}
+	return sqrt(re * re + im * im);
+}
+
+static double db(double ratio)
+{
+	return 20 * log10(ratio);
+}
+
+// the difference tone keeps its level within 1 dB up to 15 kHz and is at
+// most 1.5 dB down at 18 kHz. Single sideband falls off below 2 kHz, at
+// the lower edge of the Hilbert FIR, so 1 kHz is only checked for DSB.
+static void test_passband(void)
+{
+	const double rates[3] = { 192000, 281000, 352800 };
+	const double offsets[6] = { 1000, 5000, 10000, 12000, 15000, 18000 };
+	printf("passband, dB relative to 2 kHz\n%8s", "rate");
+	for (int k = 0; k < 6; k++) printf(" %7.0f", offsets[k]);
+	printf("\n");
+	for (int r = 0; r < 3; r++) {
+		for (int sideband = HETERODYNE_DSB; sideband <= HETERODYNE_USB; sideband++) {
+			double ref = tone_level(rates[r], LO_FREQ + 2000, sideband);
+			printf("%6.0f %s", rates[r], sideband == HETERODYNE_DSB ? "D" : "U");
+			for (int k = 0; k < 6; k++) {
+				double level = db(tone_level(rates[r], LO_FREQ + offsets[k], sideband) / ref);
+				printf(" %7.2f", level);
+				if (sideband != HETERODYNE_DSB && offsets[k] < 2000) continue;
+				double low = (offsets[k] <= 15000) ? -1.0 : -1.5;
+				HOST_CHECK(level > low && level < 1.0, "%.0f Hz at %.0f Hz is %.1f dB",
+					offsets[k], rates[r], level);
+			}
+			printf("\n");
+		}
+	}
+}
+
+// single sideband keeps the wanted side of the oscillator and rejects the
+// mirror image, a tone as far below the oscillator for USB and above it
+// for LSB, by at least 50 dB from 2 to 15 kHz
+static void test_rejection(void)
+{
+	const double rates[3] = { 192000, 281000, 352800 };
+	const double offsets[5] = { 2000, 5000, 10000, 12000, 15000 };
+	printf("sideband rejection, dB\n%8s", "rate");
+	for (int k = 0; k < 5; k++) printf(" %7.0f", offsets[k]);
+	printf("\n");
+	for (int r = 0; r < 3; r++) {
+		for (int sideband = HETERODYNE_USB; sideband <= HETERODYNE_LSB; sideband++) {
+			double sign = (sideband == HETERODYNE_USB) ? 1 : -1;
+			printf("%6.0f %s", rates[r], sideband == HETERODYNE_USB ? "U" : "L");
+			for (int k = 0; k < 5; k++) {
+				double wanted = tone_level(rates[r], LO_FREQ + sign * offsets[k], sideband);
+				double image = tone_level(rates[r], LO_FREQ - sign * offsets[k], sideband);
+				double rejection = db(wanted / image);
+				printf(" %7.1f", rejection);
+				HOST_CHECK(rejection > 50.0, "%.0f Hz at %.0f Hz rejected by %.1f dB",
+					offsets[k], rates[r], rejection);
+			}
+			printf("\n");
+		}
+	}
+}
+
+int main(void)
+{
+	test_passband();
+	test_rejection();
+	return host_result();
+}
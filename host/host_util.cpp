@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "host_util.h"
+
+int host_failures = 0;
+
+void host_add_call(std::vector<int16_t> &buf, size_t at, double fs, const host_call &call)
+{
+	size_t len = call.duration * 0.001 * fs;
+	size_t edge = 0.0002 * fs;
+	if (edge > len / 2) edge = len / 2;
+	double phase = 0;
+	for (size_t i = 0; i < len && at + i < buf.size(); i++) {
+		double t = (double)i / len;
+		double f;
+		if (call.shape == HOST_SWEEP_HYPERBOLIC) {
+			f = 1.0 / (1.0 / call.fstart + (1.0 / call.fend - 1.0 / call.fstart) * t);
+		} else {
+			f = call.fstart + (call.fend - call.fstart) * t;
+		}
+		double env = 1.0;
+		if (i < edge) env = 0.5 - 0.5 * cos(M_PI * i / edge);
+		else if (len - i <= edge) env = 0.5 - 0.5 * cos(M_PI * (len - i) / edge);
+		double v = buf[at + i] + call.amplitude * 32767.0 * env * sin(phase);
+		if (v > 32767) v = 32767;
+		else if (v < -32768) v = -32768;
+		buf[at + i] = lrint(v);
+		phase += 2.0 * M_PI * f / fs;
+	}
+}
+
+void host_add_noise(std::vector<int16_t> &buf, double rms, uint32_t seed)
+{
+	// sum of 4 uniform values, close enough to gaussian for a noise floor
+	uint32_t state = seed;
+	for (size_t i = 0; i < buf.size(); i++) {
+		double sum = 0;
+		for (int k = 0; k < 4; k++) {
+			state = state * 1664525 + 1013904223;
+			sum += (state >> 8) * (1.0 / 16777216.0) - 0.5;
+		}
+		double v = buf[i] + sum * sqrt(3.0) * rms;
+		if (v > 32767) v = 32767;
+		else if (v < -32768) v = -32768;
+		buf[i] = lrint(v);
+	}
+}
+
+uint64_t host_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t host_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+void host_profile::add(size_t block, uint64_t block_ns, uint64_t block_cycles)
+{
+	if (block >= ns.size()) {
+		ns.resize(block + 1, UINT64_MAX);
+		cycles.resize(block + 1, UINT64_MAX);
+	}
+	if (block_ns < ns[block]) ns[block] = block_ns;
+	if (block_cycles < cycles[block]) cycles[block] = block_cycles;
+}
+
+double host_profile::meanNs(void) const
+{
+	double sum = 0;
+	for (size_t i = 0; i < ns.size(); i++) sum += ns[i];
+	return ns.empty() ? 0 : sum / ns.size();
+}
+
+double host_profile::medianNs(void) const
+{
+	if (ns.empty()) return 0;
+	std::vector<uint64_t> sorted(ns);
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[sorted.size() / 2];
+}
+
+uint64_t host_profile::worstNs(void) const
+{
+	return ns.empty() ? 0 : ns[worstBlock()];
+}
+
+size_t host_profile::worstBlock(void) const
+{
+	size_t worst = 0;
+	for (size_t i = 1; i < ns.size(); i++) {
+		if (ns[i] > ns[worst]) worst = i;
+	}
+	return worst;
+}
+
+double host_profile::meanCycles(void) const
+{
+	double sum = 0;
+	for (size_t i = 0; i < cycles.size(); i++) sum += cycles[i];
+	return cycles.empty() ? 0 : sum / cycles.size();
+}
+
+uint64_t host_profile::worstCycles(void) const
+{
+	uint64_t worst = 0;
+	for (size_t i = 0; i < cycles.size(); i++) {
+		if (cycles[i] > worst) worst = cycles[i];
+	}
+	return worst;
+}
+
+bool host_read_raw(const char *path, std::vector<int16_t> &data)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) return false;
+	data.clear();
+	uint8_t pair[2];
+	while (fread(pair, 1, 2, f) == 2) {
+		data.push_back((int16_t)(pair[0] | (pair[1] << 8)));
+	}
+	fclose(f);
+	return true;
+}
+
+bool host_write_raw(const char *path, const int16_t *data, size_t len)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) return false;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t pair[2] = { (uint8_t)data[i], (uint8_t)((uint16_t)data[i] >> 8) };
+		fwrite(pair, 1, 2, f);
+	}
+	return fclose(f) == 0;
+}
+
+bool host_golden(const char *dir, const char *name, const std::vector<int16_t> &data, int tolerance)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	const char *update = getenv("HOST_UPDATE_GOLDEN");
+	if (update && atoi(update)) {
+		bool ok = host_write_raw(path, data.data(), data.size());
+		HOST_CHECK(ok, "cannot write %s", path);
+		return ok;
+	}
+	std::vector<int16_t> golden;
+	if (!host_read_raw(path, golden)) {
+		HOST_CHECK(false, "no golden file %s, run with HOST_UPDATE_GOLDEN=1 to make it", path);
+		return false;
+	}
+	if (golden.size() != data.size()) {
+		HOST_CHECK(false, "%s: %zu samples, golden file has %zu", name, data.size(), golden.size());
+		return false;
+	}
+	int worst = 0;
+	size_t worst_at = 0;
+	for (size_t i = 0; i < data.size(); i++) {
+		int diff = abs(data[i] - golden[i]);
+		if (diff > worst) {
+			worst = diff;
+			worst_at = i;
+		}
+	}
+	HOST_CHECK(worst <= tolerance, "%s: sample %zu is %d, golden %d",
+		name, worst_at, data[worst_at], golden[worst_at]);
+	return worst <= tolerance;
+}
+
+int host_result(void)
+{
+	if (AudioStream::blocksInUse() != 0) {
+		HOST_CHECK(false, "%d audio blocks were never released", AudioStream::blocksInUse());
+	}
+	if (host_failures) {
+		printf("%d check(s) failed\n", host_failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
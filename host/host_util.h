@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Shared parts of the host tests and tools: synthetic bat calls, running a
+// node block by block, timing, golden files and checks.
+
+#ifndef host_util_h_
+#define host_util_h_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "AudioStream.h"
+
+#define HOST_SWEEP_LINEAR      0  // frequency changes at a constant rate
+#define HOST_SWEEP_HYPERBOLIC  1  // period changes at a constant rate, like most FM bats
+
+// one synthetic call, with 0.2 ms raised cosine edges
+struct host_call {
+	double fstart;     // Hz
+	double fend;       // Hz, the same as fstart for a constant frequency call
+	double duration;   // ms
+	int shape;
+	double amplitude;  // of full scale
+};
+
+// add call to buf from sample at on, clipped to the buffer
+void host_add_call(std::vector<int16_t> &buf, size_t at, double fs, const host_call &call);
+// add white noise of the given rms, the same sequence for the same seed
+void host_add_noise(std::vector<int16_t> &buf, double rms, uint32_t seed);
+
+// monotonic clock and, on x86, the time stamp counter
+uint64_t host_ns(void);
+uint64_t host_cycles(void);
+
+// Per block times of update() over repeated runs of the same input. Each
+// block keeps its fastest run, which takes out most of the scheduler noise.
+struct host_profile {
+	std::vector<uint64_t> ns;
+	std::vector<uint64_t> cycles;
+	void add(size_t block, uint64_t block_ns, uint64_t block_cycles);
+	double meanNs(void) const;
+	double medianNs(void) const;
+	uint64_t worstNs(void) const;
+	size_t worstBlock(void) const;
+	double meanCycles(void) const;
+	uint64_t worstCycles(void) const;
+};
+
+// Run one update() of node on a block of in and copy output index to out,
+// zeros when the node transmitted nothing. The time of update() is added
+// to profile as block number block if there is a profile.
+template <class node_t>
+void host_update(node_t &node, const int16_t *in, int16_t *out,
+	host_profile *profile = NULL, size_t block = 0, int index = 0)
+{
+	audio_block_t *input = host_allocate();
+	memcpy(input->data, in, sizeof(input->data));
+	host_input(node, input);
+	uint64_t c0 = host_cycles();
+	uint64_t t0 = host_ns();
+	node.update();
+	uint64_t t1 = host_ns();
+	uint64_t c1 = host_cycles();
+	if (profile) profile->add(block, t1 - t0, c1 - c0);
+	for (int i = 0; i < AUDIO_HOST_OUTPUTS; i++) {
+		audio_block_t *result = host_output(node, i);
+		if (i == index && out) {
+			if (result) memcpy(out, result->data, sizeof(result->data));
+			else memset(out, 0, AUDIO_BLOCK_SAMPLES * sizeof(int16_t));
+		}
+		host_release(result);
+	}
+}
+
+// raw recordings as the sketch writes them: 16 bit little endian mono
+bool host_read_raw(const char *path, std::vector<int16_t> &data);
+bool host_write_raw(const char *path, const int16_t *data, size_t len);
+
+// Compare data with the golden file dir/name, no sample may differ by more
+// than tolerance. With HOST_UPDATE_GOLDEN=1 in the environment the golden
+// file is written instead.
+bool host_golden(const char *dir, const char *name, const std::vector<int16_t> &data, int tolerance);
+
+// checks count failures and carry on, host_result() is the exit code
+extern int host_failures;
+#define HOST_CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		host_failures++; \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+int host_result(void);
+
+#endif
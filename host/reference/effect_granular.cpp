@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2018 John-Michael Reed
+ * bleeplabs.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// AudioEffectGranular as it was before update() was split into per-mode
+// kernels, only built into granular_bench to compare against.
+
+#include <Arduino.h>
+#include "effect_granular.h"
+
+// 4-tap windowed sinc (Lanczos, a=2) in 32 fractional phases, Q15.
+// Taps apply to the samples at offsets -1, 0, +1 and +2 of the read position.
+static const int16_t te_fir_taps[32][4] = {
+	{     0,  32767,      0,      0},
+	{  -611,  32694,    693,     -8},
+	{ -1141,  32476,   1465,    -34},
+	{ -1591,  32118,   2317,    -78},
+	{ -1963,  31626,   3245,   -141},
+	{ -2260,  31005,   4245,   -223},
+	{ -2487,  30265,   5313,   -324},
+	{ -2648,  29414,   6445,   -444},
+	{ -2748,  28462,   7635,   -581},
+	{ -2793,  27418,   8876,   -734},
+	{ -2789,  26294,  10164,   -902},
+	{ -2740,  25099,  11490,  -1081},
+	{ -2654,  23844,  12847,  -1270},
+	{ -2536,  22540,  14228,  -1465},
+	{ -2392,  21197,  15625,  -1662},
+	{ -2228,  19824,  17029,  -1858},
+	{ -2048,  18431,  18431,  -2048},
+	{ -1858,  17029,  19824,  -2228},
+	{ -1662,  15625,  21197,  -2392},
+	{ -1465,  14228,  22540,  -2536},
+	{ -1270,  12847,  23844,  -2654},
+	{ -1081,  11490,  25099,  -2740},
+	{  -902,  10164,  26294,  -2789},
+	{  -734,   8876,  27418,  -2793},
+	{  -581,   7635,  28462,  -2748},
+	{  -444,   6445,  29414,  -2648},
+	{  -324,   5313,  30265,  -2487},
+	{  -223,   4245,  31005,  -2260},
+	{  -141,   3245,  31626,  -1963},
+	{   -78,   2317,  32118,  -1591},
+	{   -34,   1465,  32476,  -1141},
+	{    -8,    693,  32694,   -611},
+};
+
+static inline int16_t te_saturate(int32_t val)
+{
+	if (val > 32767) return 32767;
+	if (val < -32768) return -32768;
+	return val;
+}
+
+// Time expansion playback kernels.  Each renders up to len samples
+// from bank, starting at the 16.16 position *acc and advancing by
+// rate, and stops early once the integer position reaches limit.  The
+// caller keeps the position at 1 or above and limit two samples short of
+// the recorded data, so every kernel may read bank[idx-1] to bank[idx+2].
+// The return value is the number of samples written to out.
+static int te_truncate(const int16_t *bank, int16_t *out, int len,
+	uint32_t *acc, uint32_t rate, int32_t limit)
+{
+	uint32_t pos = *acc;
+	int n;
+
+	for (n = 0; n < len; n++) {
+		int32_t idx = pos >> 16;
+		if (idx >= limit) break;
+		out[n] = bank[idx];
+		pos += rate;
+	}
+	*acc = pos;
+	return n;
+}
+
+static int te_linear(const int16_t *bank, int16_t *out, int len,
+	uint32_t *acc, uint32_t rate, int32_t limit)
+{
+	uint32_t pos = *acc;
+	int n;
+
+	for (n = 0; n < len; n++) {
+		int32_t idx = pos >> 16;
+		if (idx >= limit) break;
+		int32_t x0 = bank[idx];
+		int32_t x1 = bank[idx + 1];
+		int32_t t = (pos >> 1) & 0x7FFF;
+		out[n] = x0 + (((x1 - x0) * t) >> 15);
+		pos += rate;
+	}
+	*acc = pos;
+	return n;
+}
+
+static int te_hermite(const int16_t *bank, int16_t *out, int len,
+	uint32_t *acc, uint32_t rate, int32_t limit)
+{
+	uint32_t pos = *acc;
+	int n;
+
+	for (n = 0; n < len; n++) {
+		int32_t idx = pos >> 16;
+		if (idx >= limit) break;
+		const int16_t *p = bank + idx;
+		int32_t xm1 = p[-1], x0 = p[0], x1 = p[1], x2 = p[2];
+		int32_t t = (pos >> 1) & 0x7FFF;
+		// Catmull-Rom coefficients, each scaled by 2
+		int32_t a = (x2 - xm1) + 3 * (x0 - x1);
+		int32_t b = 2 * xm1 - 5 * x0 + 4 * x1 - x2;
+		int32_t c = x1 - xm1;
+		int32_t v = (int32_t)(((int64_t)a * t) >> 15) + b;
+		v = (int32_t)(((int64_t)v * t) >> 15) + c;
+		v = (int32_t)(((int64_t)v * t) >> 16) + x0;
+		out[n] = te_saturate(v);
+		pos += rate;
+	}
+	*acc = pos;
+	return n;
+}
+
+static int te_fir(const int16_t *bank, int16_t *out, int len,
+	uint32_t *acc, uint32_t rate, int32_t limit)
+{
+	uint32_t pos = *acc;
+	int n;
+
+	for (n = 0; n < len; n++) {
+		int32_t idx = pos >> 16;
+		if (idx >= limit) break;
+		const int16_t *p = bank + idx;
+		const int16_t *h = te_fir_taps[(pos >> 11) & 31];
+		int32_t sum = p[-1] * h[0] + p[0] * h[1] + p[1] * h[2] + p[2] * h[3];
+		out[n] = te_saturate((sum + 16384) >> 15);
+		pos += rate;
+	}
+	*acc = pos;
+	return n;
+}
+
+static int te_render(uint8_t interp, const int16_t *bank, int16_t *out,
+	int len, uint32_t *acc, uint32_t rate, int32_t limit)
+{
+	switch (interp) {
+	case GRANULAR_INTERP_NONE:
+		return te_truncate(bank, out, len, acc, rate, limit);
+	case GRANULAR_INTERP_LINEAR:
+		return te_linear(bank, out, len, acc, rate, limit);
+	case GRANULAR_INTERP_HERMITE:
+		return te_hermite(bank, out, len, acc, rate, limit);
+	default:
+		return te_fir(bank, out, len, acc, rate, limit);
+	}
+}
+
+void AudioEffectGranular::begin(int16_t *sample_bank_def, int16_t max_len_def)
+{
+	max_sample_len = max_len_def;
+	grain_mode = 0;
+	read_head = 0;
+	write_head = 0;
+	prev_input = 0;
+	playpack_rate = 65536;
+	accumulator = 0;
+	allow_len_change = true;
+	sample_loaded = false;
+	sample_bank = sample_bank_def;
+	interp_mode = GRANULAR_INTERP_LINEAR;
+	divider = 10;
+	divider_shape = GRANULAR_DIVIDER_SQUARE;
+	bank_count = 1;
+	bank_len = max_len_def;
+	bank_first = 0;
+	bank_used = 0;
+	dropped_calls = 0;
+}
+
+void AudioEffectGranular::setBanks(int count)
+{
+	if (count < 1) count = 1;
+	else if (count > GRANULAR_MAX_BANKS) count = GRANULAR_MAX_BANKS;
+	__disable_irq();
+	bank_count = count;
+	bank_len = max_sample_len / count;
+	bank_first = 0;
+	bank_used = 0;
+	write_en = false;
+	__enable_irq();
+}
+
+void AudioEffectGranular::beginFreeze_int(int grain_samples)
+{
+	__disable_irq();
+	grain_mode = 1;
+	if (grain_samples < max_sample_len) {
+		freeze_len = grain_samples;
+	} else {
+		freeze_len = grain_samples;
+	}
+	sample_loaded = false;
+	write_en = false;
+	sample_req = true;
+	__enable_irq();
+}
+
+void AudioEffectGranular::beginPitchShift_int(int grain_samples)
+{
+	__disable_irq();
+	grain_mode = 2;
+	if (allow_len_change) {
+		if (grain_samples < 100) grain_samples = 100;
+		int maximum = (max_sample_len - 1) / 3;
+		if (grain_samples > maximum) grain_samples = maximum;
+		glitch_len = grain_samples;
+	}
+	grain_capture = 0;
+	grain_ready = 1;
+	grain_play = 2;
+	sample_loaded = false;
+	play_sample = false;
+	write_en = false;
+	sample_req = true;
+	__enable_irq();
+}
+
+void AudioEffectGranular::beginTimeExpansion_int(int grain_samples)
+{
+	__disable_irq();
+	if (grain_mode != 3) {
+		grain_mode = 3;
+		bank_first = 0;
+		bank_used = 0;
+		write_en = false;
+	}
+	if (allow_len_change) {
+		if (grain_samples > max_sample_len) {
+		grain_samples = max_sample_len;
+	     } 
+		glitch_len = grain_samples;
+	}
+	sample_req = true;
+
+	__enable_irq();
+}
+
+void AudioEffectGranular::beginDivider_int(int grain_samples)
+{
+	__disable_irq();
+	grain_mode = 4;
+	divider_env = 0;
+	divider_level = 0;
+	divider_sign = 1;
+	divider_count = 0;
+	divider_high = false;
+	__enable_irq();
+}
+
+
+void AudioEffectGranular::stop()
+{
+	grain_mode = 0;
+	allow_len_change = true;
+}
+
+void AudioEffectGranular::update(void)
+{
+	audio_block_t *block;
+	
+	if (sample_bank == NULL) {
+		block = receiveReadOnly(0);
+		if (block) release(block);
+		return;
+	}
+
+	block = receiveWritable(0);
+	
+	if (!block) return;
+
+	if (grain_mode == 0) {
+		// passthrough, no granular effect
+		prev_input = block->data[AUDIO_BLOCK_SAMPLES-1];
+	}
+	else if (grain_mode == 1) {
+		// Freeze - sample 1 grain, then repeatedly play it back
+		for (int j = 0; j < AUDIO_BLOCK_SAMPLES; j++) {
+			if (sample_req) {
+				// only begin capture on zero cross
+				int16_t current_input = block->data[j];
+				if ((current_input < 0 && prev_input >= 0) ||
+				  (current_input >= 0 && prev_input < 0)) {
+					write_en = true;
+					write_head = 0;
+					read_head = 0;
+					sample_req = false;
+				} else {
+					prev_input = current_input;
+				}
+			}
+			if (write_en) {
+				sample_bank[write_head++] = block->data[j];
+				if (write_head >= freeze_len) {
+					sample_loaded = true;
+				}
+				if (write_head >= max_sample_len) {
+					write_en = false;
+				}
+			}
+			if (sample_loaded) {
+				if (playpack_rate >= 0) {
+					accumulator += playpack_rate;
+					read_head = accumulator >> 16;
+				}
+				if (read_head >= freeze_len) {
+					accumulator = 0;
+					read_head = 0;
+				}
+				block->data[j] = sample_bank[read_head];
+			}
+		}
+	}
+	else if (grain_mode == 2) {
+		//GLITCH SHIFT
+		//basic granular synth thingy
+		// the shorter the sample the max_sample_len the more tonal it is.
+		// Longer it has more definition.  It's a bit roboty either way which
+		// is obv great and good enough for noise music.
+
+		// The bank holds 3 grains: the one being recorded, the latest
+		// complete one and the one being played.  Grains are handed on by
+		// swapping their indices, so nothing gets copied in here.
+		int k = 0;
+		if (sample_req) {
+			// only start recording when the audio is crossing zero to minimize pops
+			for (; k < AUDIO_BLOCK_SAMPLES; k++) {
+				int16_t current_input = block->data[k];
+				if ((current_input < 0 && prev_input >= 0) ||
+				  (current_input >= 0 && prev_input < 0)) {
+					sample_req = false;
+					write_en = true;
+					write_head = 0;
+					allow_len_change = true; // Reduces noise by not allowing the
+						// length to change after the sample has been
+						// recored.  Kind of not too much though
+					break;
+				}
+				prev_input = current_input;
+			}
+		}
+
+		if (write_en) {
+			int n = glitch_len - write_head;
+			if (n > AUDIO_BLOCK_SAMPLES - k) n = AUDIO_BLOCK_SAMPLES - k;
+			memcpy(sample_bank + grain_capture * glitch_len + write_head,
+				block->data + k, n * sizeof(int16_t));
+			write_head += n;
+			if (write_head >= glitch_len) {
+				uint8_t done = grain_capture;
+				grain_capture = grain_ready;
+				grain_ready = done;
+				sample_loaded = true;
+				write_en = false;
+				allow_len_change = false;
+				prev_input = block->data[k + n - 1];
+				sample_req = true;
+			}
+		}
+
+		const int16_t *grain = sample_bank + grain_play * glitch_len;
+		int16_t fade_start = glitch_len - 20;
+		for (k = 0; k < AUDIO_BLOCK_SAMPLES; k++) {
+			accumulator += playpack_rate;
+			read_head = (accumulator >> 16);
+
+			if (read_head >= glitch_len) {
+				read_head -= glitch_len;
+				accumulator = 0;
+				// start playing the latest complete grain
+				if (sample_loaded) {
+					uint8_t next = grain_ready;
+					grain_ready = grain_play;
+					grain_play = next;
+					grain = sample_bank + grain_play * glitch_len;
+					sample_loaded = false;
+					play_sample = true;
+				}
+			}
+
+			int32_t out = grain[read_head];
+			if (!play_sample || read_head < 2) {
+				// I'm off by one somewhere? why is there a tick at the
+				// beginning of this only when it's combined with the
+				// fade out???? ooor am i osbserving that incorrectly
+				// either wait it works enough
+				out = 0;
+			} else if (read_head >= fade_start) {
+				// fade out the end over 20 samples. You can just make it 0
+				// but it's a little too daleky
+				out = (out * ((glitch_len - read_head) * 1638)) >> 15;
+			}
+			block->data[k] = out;
+		}
+	} 
+	else if (grain_mode == 3) {
+		//TIME EXPANSION
+		// every requested sample gets its own bank. Banks are recorded and
+		// played in round robin order, so the next call can be recorded
+		// while an earlier one is still playing
+		if (sample_req) {
+			sample_req = false;
+			if (write_en) {
+				// still recording this call
+			} else if (bank_used >= bank_count) {
+				dropped_calls++;
+			} else {
+				bank_capture = (bank_first + bank_used) % bank_count;
+				bank_fill[bank_capture] = 0;
+				if (bank_used == 0) {
+					accumulator = 1 << 16; // kernels look one sample back
+				}
+				bank_used++;
+				write_en = true;
+			}
+		}
+
+		//collect the incoming block until the bank is full
+		if (write_en) {
+			int16_t len = (glitch_len < bank_len) ? glitch_len : bank_len;
+			int16_t fill = bank_fill[bank_capture];
+			int n = len - fill;
+			if (n > AUDIO_BLOCK_SAMPLES) n = AUDIO_BLOCK_SAMPLES;
+			memcpy(sample_bank + bank_capture * bank_len + fill,
+				block->data, n * sizeof(int16_t));
+			fill += n;
+			bank_fill[bank_capture] = fill;
+			if (fill >= len) write_en = false;
+		}
+
+		// playback follows the write head at playpack_rate and moves on
+		// to the next queued bank without a gap
+		int n = 0;
+		while (bank_used > 0 && n < AUDIO_BLOCK_SAMPLES) {
+			n += te_render(interp_mode, sample_bank + bank_first * bank_len,
+				block->data + n, AUDIO_BLOCK_SAMPLES - n, &accumulator,
+				playpack_rate, bank_fill[bank_first] - 2);
+			if (n >= AUDIO_BLOCK_SAMPLES) break;
+			// playback caught up with the recording
+			if (write_en && bank_capture == bank_first) break;
+			bank_first = (bank_first + 1) % bank_count;
+			bank_used--;
+			accumulator = 1 << 16;
+		}
+		// silence when idle
+		for (; n < AUDIO_BLOCK_SAMPLES; n++) {
+			block->data[n] = 0;
+		}
+	}
+	else if (grain_mode == 4) {
+		//FREQUENCY DIVIDER
+		// count zero crossings of the input, with a hysteresis of 1/8th of
+		// the envelope to ignore noise, and flip the output every divider
+		// crossings. A full output period takes 2*divider crossings, which
+		// is divider input periods. The output follows the input envelope.
+		int32_t env = divider_env;
+		int32_t level = divider_level;
+		for (int k = 0; k < AUDIO_BLOCK_SAMPLES; k++) {
+			int32_t in = block->data[k];
+			int32_t mag = ((in < 0) ? -in : in) << 8;
+			// fast attack, slow release
+			if (mag > env) env += (mag - env) >> 2;
+			else env -= (env - mag) >> 9;
+
+			int32_t hyst = (env >> 11) + 32;
+			if (divider_high) {
+				if (in < -hyst) {
+					divider_high = false;
+					divider_count++;
+				}
+			} else if (in > hyst) {
+				divider_high = true;
+				divider_count++;
+			}
+			if (divider_count >= divider) {
+				divider_count = 0;
+				divider_sign = -divider_sign;
+			}
+
+			int32_t out = divider_sign * (env >> 8);
+			if (divider_shape == GRANULAR_DIVIDER_SHAPED) {
+				level += (out - level) >> 3;
+				out = level;
+			}
+			block->data[k] = te_saturate(out);
+		}
+		divider_env = env;
+		divider_level = level;
+	}
+
+	transmit(block);
+	release(block);
+}
+
+
+
+
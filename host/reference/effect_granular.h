@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018 John-Michael Reed
+ * bleeplabs.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "AudioStream.h"
+
+// playback kernels for time expansion (grain_mode 3)
+#define GRANULAR_INTERP_NONE     0  // truncate, repeats each sample
+#define GRANULAR_INTERP_LINEAR   1  // 2-point linear
+#define GRANULAR_INTERP_HERMITE  2  // 4-point cubic Hermite (Catmull-Rom)
+#define GRANULAR_INTERP_FIR      3  // 4-tap, 32-phase windowed sinc
+
+// time expansion can split the sample bank into banks that take turns:
+// one records the next call while an earlier one is played back
+#define GRANULAR_MAX_BANKS       4
+
+// frequency divider (grain_mode 4) output waveforms
+#define GRANULAR_DIVIDER_SQUARE  0
+#define GRANULAR_DIVIDER_SHAPED  1  // square with rounded edges
+
+class AudioEffectGranular : public AudioStream
+{
+public:
+	AudioEffectGranular(void): AudioStream(1,inputQueueArray) { }
+	void begin(int16_t *sample_bank_def, int16_t max_len_def);
+	void setSpeed(float ratio) {
+		if (ratio < 0.01) ratio = 0.01;
+		else if (ratio > 8.0) ratio = 8.0;
+		playpack_rate = ratio * 65536.0 + 0.499;
+
+	}
+	// frequency divider: output toggles every ratio zero crossings
+	void setdivider(int ratio) {
+		if (ratio < 2) ratio = 2;
+		else if (ratio > 50) ratio = 50;
+		divider = ratio;
+	}
+	void setDividerShape(int shape) {
+		divider_shape = (shape == GRANULAR_DIVIDER_SHAPED) ? shape : GRANULAR_DIVIDER_SQUARE;
+	}
+	void setInterpolation(int mode) {
+		if (mode < GRANULAR_INTERP_NONE) mode = GRANULAR_INTERP_NONE;
+		else if (mode > GRANULAR_INTERP_FIR) mode = GRANULAR_INTERP_FIR;
+		interp_mode = mode;
+	}
+	
+	void beginFreeze(float grain_length) {
+		if (grain_length <= 0.0) return;
+		beginFreeze_int(grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
+	}
+
+	void beginPitchShift(float grain_length) {
+		if (grain_length <= 0.0) return;
+		beginPitchShift_int(grain_length * (AUDIO_SAMPLE_RATE_EXACT * 0.001) + 0.5);
+	}
+	
+	void beginTimeExpansion(float grain_length) {
+		if (grain_length <= 0.0) return;
+		beginTimeExpansion_int(grain_length);
+		
+	}
+	
+	// close the recording of the current call, its bank stays queued
+	// for playback
+	void stopTimeExpansion() {
+		write_en = false;
+	}
+
+	void setBanks(int count);
+	// calls that found every bank busy since begin()
+	uint32_t droppedCalls(void) { return dropped_calls; }
+	// recorded calls waiting for or in playback
+	int queuedCalls(void) { return bank_used; }
+
+	void beginDivider(float grain_length) {
+		if (grain_length <= 0.0) return;
+		beginDivider_int(grain_length);
+	}
+	
+	void stop();
+	virtual void update(void);
+private:
+	void beginFreeze_int(int grain_samples);
+	void beginPitchShift_int(int grain_samples);
+	void beginTimeExpansion_int(int grain_samples);
+	void beginDivider_int(int grain_samples);
+	audio_block_t *inputQueueArray[1];
+	int16_t *sample_bank;
+	uint32_t playpack_rate;
+	uint32_t accumulator;
+	int16_t max_sample_len;
+	int16_t write_head;
+	int16_t read_head;
+	int16_t grain_mode;
+	int16_t freeze_len;
+	int16_t prev_input;
+	int16_t glitch_len;
+	int32_t divider_env;    // input envelope, Q8
+	int32_t divider_level;  // shaped output
+	int16_t divider_sign;
+	uint8_t divider;
+	uint8_t divider_count;
+	uint8_t divider_shape;
+	bool divider_high;
+	uint8_t interp_mode;
+	uint8_t bank_count;
+	uint8_t bank_first; // bank being played, others follow round robin
+	uint8_t bank_used;
+	uint8_t bank_capture;
+	int16_t bank_len;
+	int16_t bank_fill[GRANULAR_MAX_BANKS];
+	uint32_t dropped_calls;
+	uint8_t grain_capture; // pitch shift grains, as thirds of the bank
+	uint8_t grain_ready;
+	uint8_t grain_play;
+
+    bool play_sample;
+	bool allow_len_change;
+	bool sample_loaded;
+	bool write_en;
+	bool sample_req;
+};
+
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmark of AudioAnalyzeSpectrum in each of its 12 size and overlap
+// configurations, Hann window, gate off, on calls in noise at 281 kHz.
+// The table gives the time and cycles of update() divided by the frames it
+// computed, the frames per block and the share of real time the node takes. Each figure is the fastest of
+// several runs. The FFT is the stub's Q15 one in plain C, so the figures
+// rank the configurations rather than predict the Teensy.
+
+#include <stdio.h>
+#include "analyze_spectrum.h"
+#include "host_util.h"
+
+#define SAMPLE_RATE  281000
+#define BLOCKS       256
+#define RUNS         10
+
+// counts the frames the node computes
+class SpectrumCounter : public AudioAnalyzeSpectrum
+{
+public:
+	SpectrumCounter(void) : frames(0) { }
+	uint32_t frames;
+protected:
+	virtual void analyzed(const uint16_t *bins, uint32_t sample) { frames++; }
+};
+
+static uint16_t bins[SPECTRUM_MAX_SIZE / 2];
+
+int main(void)
+{
+	std::vector<int16_t> input(BLOCKS * AUDIO_BLOCK_SAMPLES);
+	for (int i = 0; i < 8; i++) {
+		host_call call = { 80000, 40000, 5.0, HOST_SWEEP_HYPERBOLIC, 0.5 };
+		host_add_call(input, (i * 32 + 4) * AUDIO_BLOCK_SAMPLES, SAMPLE_RATE, call);
+	}
+	host_add_noise(input, 200, 9);
+	double block_ns = 1e9 * AUDIO_BLOCK_SAMPLES / SAMPLE_RATE;
+
+	const int sizes[4] = { 128, 256, 512, 1024 };
+	const int overlaps[3] = { 0, 50, 75 };
+	printf("%6s %8s %12s %12s %12s %8s\n", "size", "overlap", "ns/frame", "cycles/frame",
+		"frames/block", "load");
+	for (int s = 0; s < 4; s++) {
+		for (int o = 0; o < 3; o++) {
+			host_profile profile;
+			uint32_t frames = 0;
+			for (int run = 0; run < RUNS; run++) {
+				SpectrumCounter spectrum;
+				spectrum.configure(sizes[s], overlaps[o], SPECTRUM_WINDOW_HANN, bins);
+				for (int b = 0; b < BLOCKS; b++) {
+					host_update(spectrum, &input[b * AUDIO_BLOCK_SAMPLES], NULL, &profile, b);
+				}
+				frames = spectrum.frames;
+			}
+			HOST_CHECK(frames > 0, "no frames at %d points, %d%%", sizes[s], overlaps[o]);
+			if (frames == 0) continue;
+			double per_block = (double)frames / BLOCKS;
+			printf("%6d %7d%% %12.0f %12.0f %12.2f %7.1f%%\n", sizes[s], overlaps[o],
+				profile.meanNs() / per_block, profile.meanCycles() / per_block,
+				per_block, 100.0 * profile.meanNs() / block_ns);
+		}
+	}
+	return host_result();
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include "AudioStream.h"
+
+int AudioStream::blocks_in_use = 0;
+
+AudioStream::AudioStream(unsigned char ninput, audio_block_t **iqueue)
+{
+	num_inputs = ninput;
+	inputQueue = iqueue;
+	for (int i = 0; i < ninput; i++) inputQueue[i] = NULL;
+	for (int i = 0; i < AUDIO_HOST_OUTPUTS; i++) outputQueue[i] = NULL;
+}
+
+AudioStream::~AudioStream()
+{
+	for (int i = 0; i < num_inputs; i++) release(inputQueue[i]);
+	for (int i = 0; i < AUDIO_HOST_OUTPUTS; i++) release(outputQueue[i]);
+}
+
+audio_block_t * AudioStream::allocate(void)
+{
+	audio_block_t *block = (audio_block_t *)calloc(1, sizeof(audio_block_t));
+	if (!block) return NULL;
+	block->ref_count = 1;
+	blocks_in_use++;
+	return block;
+}
+
+void AudioStream::release(audio_block_t *block)
+{
+	if (!block) return;
+	if (--block->ref_count == 0) {
+		free(block);
+		blocks_in_use--;
+	}
+}
+
+// like the library, the block is shared with the receiver, not copied
+void AudioStream::transmit(audio_block_t *block, unsigned char index)
+{
+	if (index >= AUDIO_HOST_OUTPUTS) return;
+	release(outputQueue[index]);
+	block->ref_count++;
+	outputQueue[index] = block;
+}
+
+audio_block_t * AudioStream::receiveReadOnly(unsigned int index)
+{
+	if (index >= num_inputs) return NULL;
+	audio_block_t *in = inputQueue[index];
+	inputQueue[index] = NULL;
+	return in;
+}
+
+audio_block_t * AudioStream::receiveWritable(unsigned int index)
+{
+	if (index >= num_inputs) return NULL;
+	audio_block_t *in = inputQueue[index];
+	inputQueue[index] = NULL;
+	if (in && in->ref_count > 1) {
+		audio_block_t *p = allocate();
+		if (p) memcpy(p->data, in->data, sizeof(p->data));
+		in->ref_count--;
+		in = p;
+	}
+	return in;
+}
+
+void host_input(AudioStream &node, audio_block_t *block, unsigned int index)
+{
+	if (index >= node.num_inputs) {
+		AudioStream::release(block);
+		return;
+	}
+	AudioStream::release(node.inputQueue[index]);
+	node.inputQueue[index] = block;
+}
+
+audio_block_t *host_output(AudioStream &node, unsigned int index)
+{
+	if (index >= AUDIO_HOST_OUTPUTS) return NULL;
+	audio_block_t *out = node.outputQueue[index];
+	node.outputQueue[index] = NULL;
+	return out;
+}
+
+audio_block_t *host_allocate(void)
+{
+	return AudioStream::allocate();
+}
+
+void host_release(audio_block_t *block)
+{
+	AudioStream::release(block);
+}
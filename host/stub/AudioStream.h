@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host stand-in for the Teensy Audio library's AudioStream, with just what
+// the nodes of this sketch use. Blocks come from the heap and there is no
+// audio graph: a test hands a node its input with host_input(), calls
+// update() and collects what it transmitted with host_output().
+
+#ifndef AudioStream_h_
+#define AudioStream_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define AUDIO_BLOCK_SAMPLES  128
+#define AUDIO_SAMPLE_RATE_EXACT 44117.64706f
+#define AUDIO_SAMPLE_RATE AUDIO_SAMPLE_RATE_EXACT
+
+// outputs per node that host_output() can collect
+#define AUDIO_HOST_OUTPUTS   4
+
+typedef struct audio_block_struct {
+	uint8_t  ref_count;
+	uint8_t  reserved1;
+	uint16_t memory_pool_index;
+	int16_t  data[AUDIO_BLOCK_SAMPLES];
+} audio_block_t;
+
+class AudioStream
+{
+public:
+	AudioStream(unsigned char ninput, audio_block_t **iqueue);
+	virtual ~AudioStream();
+	// there is no audio interrupt to measure, the host tests time update()
+	// themselves
+	float processorUsage(void) { return 0; }
+	float processorUsageMax(void) { return 0; }
+	void processorUsageMaxReset(void) { }
+	// blocks allocated and not yet released, to find leaks
+	static int blocksInUse(void) { return blocks_in_use; }
+	friend void host_input(AudioStream &node, audio_block_t *block, unsigned int index);
+	friend audio_block_t *host_output(AudioStream &node, unsigned int index);
+	friend audio_block_t *host_allocate(void);
+	friend void host_release(audio_block_t *block);
+protected:
+	static audio_block_t * allocate(void);
+	static void release(audio_block_t * block);
+	void transmit(audio_block_t *block, unsigned char index = 0);
+	audio_block_t * receiveReadOnly(unsigned int index = 0);
+	audio_block_t * receiveWritable(unsigned int index = 0);
+	virtual void update(void) = 0;
+private:
+	unsigned char num_inputs;
+	audio_block_t **inputQueue;
+	audio_block_t *outputQueue[AUDIO_HOST_OUTPUTS];
+	static int blocks_in_use;
+};
+
+// queue block as input index of node, the node takes over the reference
+void host_input(AudioStream &node, audio_block_t *block, unsigned int index = 0);
+// the block node transmitted on output index since the last call, or NULL.
+// The caller releases it with host_release().
+audio_block_t *host_output(AudioStream &node, unsigned int index = 0);
+audio_block_t *host_allocate(void);
+void host_release(audio_block_t *block);
+
+// the nodes only turn interrupts off around a few shared fields
+static inline void __disable_irq(void) { }
+static inline void __enable_irq(void) { }
+
+#endif
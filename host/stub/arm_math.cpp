@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include "arm_math.h"
+
+#define HOST_FFT_MAX 4096
+
+static q15_t saturate(int32_t x)
+{
+	if (x > 32767) return 32767;
+	if (x < -32768) return -32768;
+	return x;
+}
+
+// Iterative radix-2 FFT in Q15 like the CMSIS ones: Q15 twiddles, products
+// truncated back to Q15 and every stage halving its outputs, which scales
+// the result by 1/len in steps and rounds it down each time. The radix 4
+// version halves twice per radix 4 stage instead of dividing by 4 once,
+// so its last bits may differ from CMSIS.
+static void host_cfft(q15_t *buf, int len, bool inverse)
+{
+	static q15_t re[HOST_FFT_MAX], im[HOST_FFT_MAX];
+	static q15_t cos_table[HOST_FFT_MAX / 2], sin_table[HOST_FFT_MAX / 2];
+	static int table_len = 0;
+
+	if (len < 2 || len > HOST_FFT_MAX) return;
+	if (table_len != len) {
+		for (int k = 0; k < len / 2; k++) {
+			cos_table[k] = saturate(lrint(32768.0 * cos(2.0 * M_PI * k / len)));
+			sin_table[k] = saturate(lrint(32768.0 * sin(2.0 * M_PI * k / len)));
+		}
+		table_len = len;
+	}
+	// bit reversed load
+	for (int i = 0, j = 0; i < len; i++) {
+		re[j] = buf[2 * i];
+		im[j] = buf[2 * i + 1];
+		int bit = len >> 1;
+		while (j & bit) {
+			j ^= bit;
+			bit >>= 1;
+		}
+		j |= bit;
+	}
+	int32_t sign = inverse ? 1 : -1;
+	for (int half = 1; half < len; half *= 2) {
+		int step = len / (2 * half);
+		for (int start = 0; start < len; start += 2 * half) {
+			for (int k = 0; k < half; k++) {
+				int32_t wr = cos_table[k * step];
+				int32_t wi = sign * sin_table[k * step];
+				int a = start + k, b = a + half;
+				int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+				int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+				int32_t ar = re[a], ai = im[a];
+				re[b] = saturate((ar - tr) >> 1);
+				im[b] = saturate((ai - ti) >> 1);
+				re[a] = saturate((ar + tr) >> 1);
+				im[a] = saturate((ai + ti) >> 1);
+			}
+		}
+	}
+	for (int i = 0; i < len; i++) {
+		buf[2 * i] = re[i];
+		buf[2 * i + 1] = im[i];
+	}
+}
+
+arm_status arm_cfft_radix4_init_q15(arm_cfft_radix4_instance_q15 *S,
+	uint16_t fftLen, uint8_t ifftFlag, uint8_t bitReverseFlag)
+{
+	S->fftLen = fftLen;
+	S->ifftFlag = ifftFlag;
+	S->bitReverseFlag = bitReverseFlag;
+	// radix 4 needs a power of 4
+	if (fftLen != 16 && fftLen != 64 && fftLen != 256 && fftLen != 1024) {
+		return ARM_MATH_ARGUMENT_ERROR;
+	}
+	return ARM_MATH_SUCCESS;
+}
+
+void arm_cfft_radix4_q15(const arm_cfft_radix4_instance_q15 *S, q15_t *pSrc)
+{
+	host_cfft(pSrc, S->fftLen, S->ifftFlag);
+}
+
+arm_status arm_cfft_radix2_init_q15(arm_cfft_radix2_instance_q15 *S,
+	uint16_t fftLen, uint8_t ifftFlag, uint8_t bitReverseFlag)
+{
+	S->fftLen = fftLen;
+	S->ifftFlag = ifftFlag;
+	S->bitReverseFlag = bitReverseFlag;
+	if (fftLen < 16 || fftLen > 4096 || (fftLen & (fftLen - 1))) {
+		return ARM_MATH_ARGUMENT_ERROR;
+	}
+	return ARM_MATH_SUCCESS;
+}
+
+void arm_cfft_radix2_q15(const arm_cfft_radix2_instance_q15 *S, q15_t *pSrc)
+{
+	host_cfft(pSrc, S->fftLen, S->ifftFlag);
+}
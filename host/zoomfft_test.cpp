@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Tests of AudioAnalyzeZoomFFT at 281 kHz around 70 kHz, decimating by 2,
+// 4 and 8: tones at known offsets from the centre peak in their bin, and
+// tones beyond 0.6 of the decimated rate, which the FIR must stop before
+// they alias into the span, stay far below an in-band tone.
+
+#include <stdio.h>
+#include <math.h>
+#include "analyze_zoomfft.h"
+#include "host_util.h"
+
+#define SAMPLE_RATE  281000
+#define CENTRE       70000
+#define BLOCKS       200
+
+// the last output of a zoom FFT on a tone of amplitude 0.5 at freq
+static std::vector<uint16_t> zoom_tone(int factor, double freq)
+{
+	std::vector<int16_t> input(BLOCKS * AUDIO_BLOCK_SAMPLES);
+	for (size_t i = 0; i < input.size(); i++) {
+		input[i] = lrint(16384 * sin(2 * M_PI * freq / SAMPLE_RATE * i));
+	}
+	AudioAnalyzeZoomFFT zoom;
+	zoom.setSampleRate(SAMPLE_RATE);
+	zoom.band(CENTRE, factor);
+	int frames = 0;
+	for (int b = 0; b < BLOCKS; b++) {
+		host_update(zoom, &input[b * AUDIO_BLOCK_SAMPLES], NULL);
+		if (zoom.available()) frames++;
+	}
+	HOST_CHECK(frames > 0, "factor %d: no output", factor);
+	return std::vector<uint16_t>(zoom.output, zoom.output + ZOOMFFT_SIZE);
+}
+
+static int peak_bin(const std::vector<uint16_t> &out)
+{
+	int peak = 0;
+	for (int m = 1; m < ZOOMFFT_SIZE; m++) {
+		if (out[m] > out[peak]) peak = m;
+	}
+	return peak;
+}
+
+// tones on bin centres from 100 bins below to 100 above the centre
+static void test_offsets(int factor)
+{
+	const int offsets[5] = { -100, -37, 0, 21, 100 };
+	double width = (double)SAMPLE_RATE / (factor * ZOOMFFT_SIZE);
+	for (int n = 0; n < 5; n++) {
+		std::vector<uint16_t> out = zoom_tone(factor, CENTRE + offsets[n] * width);
+		int expected = ZOOMFFT_SIZE / 2 + offsets[n];
+		int peak = peak_bin(out);
+		HOST_CHECK(peak == expected, "factor %d: tone at bin %d peaks in bin %d",
+			factor, expected, peak);
+	}
+}
+
+// Tones at 0.6 and 0.75 of the decimated rate above and below the centre
+// would alias to 0.4 and 0.25 on the other side. The bins around where
+// they would land must be at least 55 dB below the peak of an in-band
+// tone, which leaves room for the Q15 FFT's rounding next to the FIR's
+// 64 dB. The centre bins are not looked at: the mixer and the FIR round
+// down, which leaves a DC offset of a few LSB there. Decimating by 2,
+// the span around 70 kHz reaches the Nyquist frequency, so there are no
+// such tones.
+static void test_rejection(int factor)
+{
+	double rate = (double)SAMPLE_RATE / factor;
+	std::vector<uint16_t> in_band = zoom_tone(factor, CENTRE + 0.1 * rate);
+	int reference = in_band[peak_bin(in_band)];
+	const double offsets[4] = { 0.6, 0.75, -0.6, -0.75 };
+	for (int n = 0; n < 4; n++) {
+		std::vector<uint16_t> out = zoom_tone(factor, CENTRE + offsets[n] * rate);
+		double alias = offsets[n] - (offsets[n] > 0 ? 1 : -1);
+		int bin = lrint(ZOOMFFT_SIZE / 2 + alias * ZOOMFFT_SIZE);
+		int worst = 0;
+		for (int m = bin - 4; m <= bin + 4; m++) {
+			if (out[m] > worst) worst = out[m];
+		}
+		double db = 20 * log10((worst + 0.5) / reference);
+		printf("factor %d, tone at %+.2f of %.0f Hz: %.1f dB around bin %d\n",
+			factor, offsets[n], rate, db, bin);
+		HOST_CHECK(db < -55, "factor %d: tone at %+.2f of the decimated rate only %.1f dB down",
+			factor, offsets[n], db);
+	}
+}
+
+int main(void)
+{
+	for (int factor = 2; factor <= 8; factor *= 2) {
+		test_offsets(factor);
+		if (factor > 2) test_rejection(factor);
+	}
+	return host_result();
+}
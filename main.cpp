@@ -22,6 +22,9 @@
  *                       Frequency divider
  *                       Automatic heterodyne (1/10 implemented)
  *                       Automatic TimeExpansion (live)
+ *                       Single sideband heterodyne (USB/LSB)
+ *                       Dual heterodyne (left Frequency, right Freq2)
+ *                       Heterodyne (left) with Automatic TimeExpansion (right)
  *
  *  Sample rates up to 352k
  *  
@@ -147,6 +150,11 @@
 #include <TimeLib.h>
 
 #include "Audio.h"
+#include "effect_heterodyne.h"
+#include "analyze_zoomfft.h"
+#include "analyze_batdetector.h"
+#include "analyze_goertzel.h"
+#include "bat_classifier.h"
 //#include <Wire.h>
 #include <SPI.h>
 #include <Bounce.h>
@@ -154,8 +162,10 @@
 
 boolean SD_ACTIVE=false;
 boolean continousPlay=false;
-boolean batTrigger=false;//triggers when an ultrasonic signalpeak is found during FFT
-boolean TE_ready=true; //when a TEcall is played this signals the end of the call
+boolean batTrigger=false;//a call is running, set by the start event of myFFT, cleared when it leaves the call
+boolean batcall_mark=false;//a call started, the waterfall marks it
+boolean TE_ready=true; //no TE recording is running, the next call can be recorded
+const uint16_t TE_tail=10; //ms of recording kept after the end of a call
 
 time_t getTeensy3Time()
 {
@@ -213,14 +223,14 @@ uint32_t lastmillis;
 // this audio comes from the codec by I2S2
 AudioInputI2S                    i2s_in; // MIC input
 AudioRecordQueue                 recorder; 
-AudioSynthWaveformSineHires      sine1; // local oscillator
+AudioEffectHeterodyne            heterodyne1; // local oscillator, mix and low-pass
 //AudioSynthWaveformSineHires      sine2; // local oscillator
-//
-AudioEffectMultiply              heterodyne_multiplier; // multiply = mix
 //AudioEffectMultiply              mult2; // multiply = mix
 
 //AudioAnalyzeFFT1024         fft1024_1; // for waterfall display
-AudioAnalyzeFFT256               myFFT; // for spectrum display
+AudioAnalyzeBatDetector          myFFT; // for spectrum display and bat call detection
+AudioAnalyzeZoomFFT              zoomFFT; // for the zoomed waterfall of the bat band
+AudioAnalyzeGoertzelBank         goertzel1; // levels at the frequencies of target species
 
 AudioPlaySdRaw                   player; 
 
@@ -228,6 +238,7 @@ AudioEffectGranular              granular1;
 
 AudioMixer4                      mixFFT;
 AudioMixer4                      outputMixer; //selective output
+AudioMixer4                      outputMixerR; //right channel: outputMixer, the second heterodyne or granular
 AudioMixer4                      inputMixer; //selective input
 AudioOutputI2S                   i2s_out; // headphone output          
 
@@ -243,21 +254,25 @@ AudioConnection input_toswitch      (inputMixer,0,  mixFFT,0);
 AudioConnection input_todelay       (inputMixer,0, granular1, 0);
 
 AudioConnection switch_toFFT        (mixFFT,0, myFFT,0 ); //raw recording channel 
+AudioConnection switch_tozoomFFT    (mixFFT,0, zoomFFT,0 ); 
+AudioConnection switch_togoertzel   (mixFFT,0, goertzel1,0 ); 
 
-AudioConnection input_toheterodyne1 (inputMixer, 0, heterodyne_multiplier, 0); //heterodyne 1 signal
-AudioConnection sineheterodyne1    (sine1, 0, heterodyne_multiplier, 1);//heterodyne 1 mixerfreq
+AudioConnection input_toheterodyne1 (inputMixer, 0, heterodyne1, 0); //heterodyne 1 signal
 
 AudioConnection granular_toout (granular1,0, outputMixer,1);
 //AudioConnection input_toheterodyne2 (granular1, 0, mult2, 0); //heterodyne 2
 //AudioConnection sineheterodyne2     (sine2, 0, mult2, 1);//heterodyne 2 mixerfreq
 
-AudioConnection heterodyne1_toout      (heterodyne_multiplier, 0, outputMixer, 0);  //heterodyne 1 output to outputmixer
+AudioConnection heterodyne1_toout      (heterodyne1, 0, outputMixer, 0);  //heterodyne 1 output to outputmixer
 //AudioConnection heterodyne2_toout      (mult2, 0, outputMixer, 1);  //heterodyne 2 output to outputmixer
 AudioConnection player_toout           (inputMixer,0, outputMixer, 2);    //direct signal (use with player) to outputmixer
 
+AudioConnection heterodyne2_toright    (heterodyne1, 1, outputMixerR, 1);  //heterodyne 2 output to the right channel
+AudioConnection output_toright         (outputMixer, 0, outputMixerR, 0);  //mono output to the right channel
+AudioConnection granular_toright       (granular1, 0, outputMixerR, 2);  //time expansion to the right channel
+
 AudioConnection output_toheadphoneleft      (outputMixer, 0, i2s_out, 0); // output to headphone
-AudioConnection output_toheadphoneright     (outputMixer, 0, i2s_out, 1);
-//AudioConnection granular_toheadphone        (granular1,0,i2s_out,1);
+AudioConnection output_toheadphoneright     (outputMixerR, 0, i2s_out, 1);
 
 AudioControlSGTL5000        sgtl5000;  
 
@@ -265,6 +280,7 @@ AudioControlSGTL5000        sgtl5000;
 const int myInput = AUDIO_INPUT_MIC;
 
 #define GRANULAR_MEMORY_SIZE 30000  // enough for 100 ms at 281kHz
+#define GRANULAR_BANKS 2 // record a new call while the previous one is played
 int16_t granularMemory[GRANULAR_MEMORY_SIZE];
 
 // forward declaration Stop recording with message 
@@ -280,8 +296,19 @@ struct tm seconds2tm(uint32_t tt);
 elapsedMillis since_bat_detection1; //start timing directly after FFT detects an ultrasound
 elapsedMillis since_bat_detection2; //start timing directly after FFT detects the end of the ultrasound
 //
-elapsedMillis since_heterodyne=1000; //timing interval for auto_heterodyne frequency adjustments
-uint16_t callLength=0;
+//auto_heterodyne tracking
+float autoHTD_gain=0.3; //part of the distance to the new peak frequency covered per FFT frame (1=jump)
+int autoHTD_step=500; //Hz, the tracked frequency is rounded to this step, 0 or 1 to follow exactly
+float autoHTD_freq=0; //smoothed peak frequency of the current call
+#ifdef DEBUGSERIAL
+elapsedMillis since_cpu_report; //timing interval for the processor load report
+#endif
+uint16_t callLength=0; //ms
+batcall_features last_call; //parameters of the last call that ended
+BatCallClassifier classifier; //species group of every call, with counts per group
+uint8_t last_species=BATCLASS_UNKNOWN;
+boolean species_changed=true; //the counts on the tone display need redrawing
+uint32_t autoHTD_frames=0; //call frames of myFFT used for the tracking
 //uint16_t clicker=0;
 
 /************** RECORDING PLAYING SETTINGS *****************/
@@ -308,6 +335,16 @@ uint32_t nj = 0;
 
 #define waterfallgraph 1
 #define spectrumgraph 2
+#define zoomgraph 3 //waterfall of the bat band only (zoomFFT)
+#define tonegraph 4 //bars of the goertzel1 levels
+
+// constant frequencies watched by goertzel1, here the greater and the lesser
+// horseshoe bat; the window of 256 samples gives about 1.1kHz resolution at 281kHz
+const uint8_t tone_count=2;
+const float tone_freq[tone_count]={83000, 110000};
+const int tone_window=256;
+float tone_background[tone_count]; //slowly following level without calls
+elapsedMillis since_tonebars; //bars are drawn 20 times a second
 
 int idx_t = 0;
 int idx = 0;
@@ -327,8 +364,27 @@ int l_limit;
 int u_limit;
 int index_l_limit;
 int index_u_limit;
-//const uint16_t FFT_points = 1024;
+// analyzer setup, 128, 256, 512 or 1024 points with 0, 50 or 75% overlap;
+// 256 points and 50% match the former AudioAnalyzeFFT256
+#define FFT_SIZE    256
+#define FFT_OVERLAP 50
+#define FFT_WINDOW  SPECTRUM_WINDOW_HANN
+// calls are searched in this band, wide enough for the classifier to see
+// noctules and horseshoe bats
+#define BAT_BAND_LO 18000
+#define BAT_BAND_HI 120000
+// myFFT, and with it the detector and the graphs, only runs while the bat band
+// is FFT_GATE_RATIO times its background level and FFT_GATE_HOLD ms after;
+// comment out to run the FFT continuously
+#define FFT_GATE_RATIO 2.0
+#define FFT_GATE_HOLD  100
+uint16_t FFT_bins[FFT_SIZE/2]; // written by myFFT
+
+// the displays and the detector work on 128 bins of sample_rate/256, 
+// larger FFTs are folded onto them by their maximum
 const uint16_t FFT_points = 256;
+uint16_t FFT_output[FFT_points/2];
+uint16_t FFT_noise[FFT_points/2]; // noise floor of myFFT on the display bins
 
 int barm [512];
 
@@ -376,12 +432,8 @@ const SR_Descriptor SR [SAMPLE_RATE_MAX + 1] =
     {  SAMPLE_RATE_352K,  "352"}
 };    
 
-// setup for FFTgraph denoising 
-uint32_t FFTcount=0; //count the # of FFTs done 
 uint16_t powerspectrumCounter=0;
 
-float FFTavg[128];
-
 float FFTpowerspectrum[128];
 float powerspectrum_Max=0;
 
@@ -392,6 +444,7 @@ int8_t volume=50;
 
 int freq_real = 45000; // start heterodyne detecting at this frequency
 int freq_real_backup=freq_real; //used to return to proper settingafter using the play_function
+int freq_real2 = 75000; // second heterodyne frequency, right channel in detector_dual mode
 
 // initial sampling setup
 int sample_rate = SAMPLE_RATE_281K;
@@ -429,6 +482,7 @@ const Menu_Descriptor MenuEntry [Leftchoices] =
    {"Record",6,0,0,0}, //functions where the LeftEncoder 
    {"Play",4,0,0,0},
    {"PlayD",5,0,0,0},
+   {"Freq2",5,75,20,150}, //multiply 1000
 } ;
 
 //TODO constants should be part of the menuentry, a single structure to hold the info
@@ -441,6 +495,7 @@ const int8_t  MENU_SR  = 5; //sample rate
 const int8_t  MENU_REC = 6; //record
 const int8_t  MENU_PLY = 7; //play 
 const int8_t  MENU_PLD = 8; //play at original rate 
+const int8_t  MENU_FRQ2 = 9; //second heterodyne frequency
 
 //available modes
 const int detector_heterodyne=0;
@@ -448,9 +503,14 @@ const int detector_divider=1;
 const int detector_Auto_heterodyne=2;
 const int detector_Auto_TE=3;
 const int detector_passive=4;
+const int detector_SSB=5; //heterodyne, only one sideband 
+const int detector_dual=6; //two heterodyne frequencies, one per headphone channel
+const int detector_HTD_TE=7; //heterodyne left, Auto_TE right
+const int detector_last=detector_HTD_TE;
 
 //default
 int detector_mode=detector_heterodyne;  
+int heterodyne_sideband=HETERODYNE_USB; //sideband heard in detector_SSB mode
 
 //************************* ENCODER variables/constants
 const int8_t enc_menu=0; //changing encoder sets menuchoice
@@ -546,10 +606,24 @@ void display_settings() {
        break;
        case detector_Auto_TE:
         tft.print("Auto_TE");
+        tft.print(" drop:"); tft.print(granular1.droppedCalls()); //calls lost while all banks were busy
        break;
        case detector_passive:
         tft.print("PASS");
        break;
+       case detector_SSB:
+        if (heterodyne_sideband==HETERODYNE_USB)
+          tft.print("USB");
+        else
+          tft.print("LSB");
+       break;
+       case detector_dual:
+        tft.print("HTD2 f2:"); tft.print(freq_real2);
+       break;
+       case detector_HTD_TE:
+        tft.print("HTD+TE");
+        tft.print(" drop:"); tft.print(granular1.droppedCalls()); //calls lost while all banks were busy
+       break;
        default:
         tft.print("error");
        
@@ -649,29 +723,92 @@ void       set_mic_gain(int8_t gain) {
     powerspectrum_Max=0; // change the powerspectrum_Max for the FFTpowerspectrum
 } // end function set_mic_gain
 
+// highest heterodyne frequency at the current sample rate, 500 Hz below Nyquist
+int freq_Max() {
+  return int(sample_rate_real/1000)*500-500;
+}
+
+// retune without updating the display, the oscillator glides to the new
+// frequency during the next audio block
+void       track_freq_Oscillator(int freq) {
+    if (freq > freq_Max()) {
+      freq = freq_Max();
+    }
+    freq_Oscillator = freq; 
+    heterodyne1.frequency(freq_Oscillator);
+} // END of function track_freq_Oscillator
+
 void       set_freq_Oscillator(int freq) {
-    // audio lib thinks we are still in 44118sps sample rate
-    // therefore we have to scale the frequency of the local oscillator
-    // in accordance with the REAL sample rate
-      
-    freq_Oscillator = (freq) * (AUDIO_SAMPLE_RATE_EXACT / sample_rate_real); 
-    //float F_LO2= (freq+5000) * (AUDIO_SAMPLE_RATE_EXACT / sample_rate_real); 
+    // the heterodyne node knows the REAL sample rate (set_sample_rate),
+    // so the local oscillator is tuned in real Hz. 
     // if we switch to LOWER samples rates, make sure the running LO 
-    // frequency is allowed ( < 22k) ! If not, adjust consequently, so that
-    // LO freq never goes up 22k, also adjust the variable freq_real  
-    if(freq_Oscillator > 22000) {
-      freq_Oscillator = 22000;
-      freq_real = freq_Oscillator * (sample_rate_real / AUDIO_SAMPLE_RATE_EXACT) + 9;
+    // frequency stays below Nyquist, also adjust the variable freq_real  
+    if (freq > freq_Max()) {
+      freq = freq_Max();
+      freq_real = freq;
     }
+    freq_Oscillator = freq; 
     AudioNoInterrupts();
     //setup multiplier SINE
-    sine1.frequency(freq_Oscillator);
+    heterodyne1.frequency(freq_Oscillator);
     //sine2.frequency(freq_Oscillator);
         
     AudioInterrupts();
     display_settings();
 } // END of function set_freq_Oscillator
 
+// sources for the right headphone channel, the outputMixerR inputs
+const int right_mono=0; //same output as the left channel
+const int right_heterodyne2=1; //second heterodyne
+const int right_granular=2; //granular (time expansion)
+
+void set_right_channel(int source) {
+  AudioNoInterrupts();
+  if (source==right_heterodyne2)
+    { heterodyne1.frequency(1,freq_real2); //start the second oscillator
+    }
+  else
+    { heterodyne1.frequency(1,0); //stop the second oscillator
+    }
+  for (int i=0; i<3; i++)
+    { outputMixerR.gain(i,(i==source) ? 1 : 0);
+    }
+  AudioInterrupts();
+} // END of function set_right_channel
+
+// the right channel that belongs to the current detector_mode
+void set_right_channel_for_mode() {
+  if (detector_mode==detector_dual)
+    { set_right_channel(right_heterodyne2);}
+  else
+    if (detector_mode==detector_HTD_TE)
+      { set_right_channel(right_granular);}
+    else
+      { set_right_channel(right_mono);}
+} // END of function set_right_channel_for_mode
+
+void       set_freq_Oscillator2(int freq) {
+    if (freq > freq_Max()) {
+      freq = freq_Max();
+    }
+    freq_real2 = freq;
+    if (detector_mode==detector_dual)
+      { heterodyne1.frequency(1,freq_real2);
+      }
+} // END of function set_freq_Oscillator2
+
+// the zoomFFT covers the bat band 20-90kHz with the largest decimation 
+// that still spans 70kHz, it only runs while it is displayed
+void set_zoom_band() {
+  int factor=0;
+  if (displaychoice==zoomgraph)
+    { factor=8;
+      while ((factor>2) and (sample_rate_real/factor<70000)) 
+        { factor=factor/2;}
+    }
+  zoomFFT.band(55000,factor);
+} // END of function set_zoom_band
+
 // set samplerate code by Frank Boesing 
 void setI2SFreq(int freq) {
   typedef struct {
@@ -782,7 +919,13 @@ void      set_sample_rate (int sr) {
     AudioNoInterrupts();
     setI2SFreq (sample_rate_real); 
     delay(200); // this delay seems to be very essential !
+    heterodyne1.setSampleRate(sample_rate_real);
+    zoomFFT.setSampleRate(sample_rate_real);
+    goertzel1.setSampleRate(sample_rate_real);
+    myFFT.setSampleRate(sample_rate_real);
+    set_zoom_band();
     set_freq_Oscillator (freq_real);
+    set_freq_Oscillator2 (freq_real2);
     AudioInterrupts();
     delay(20);
     display_settings();
@@ -791,9 +934,35 @@ void      set_sample_rate (int sr) {
 
 
 
+// copy a new frame of myFFT and its noise floor onto the display bins, false
+// if there is none
+bool read_FFT() {
+  if (not myFFT.available()) 
+     { return false;}
+  if (FFT_SIZE>=FFT_points)
+    { const int fold=FFT_SIZE/FFT_points;
+      for (int i=0; i<FFT_points/2; i++)
+       { uint16_t maxbin=0; uint16_t maxnoise=0;
+         for (int j=0; j<fold; j++)
+           { maxbin=max(maxbin,FFT_bins[i*fold+j]);
+             maxnoise=max(maxnoise,myFFT.noiseFloor(i*fold+j));
+           }
+         FFT_output[i]=maxbin;
+         FFT_noise[i]=maxnoise;
+       }
+    }
+  else //128 points, every bin covers 2 display bins
+    { for (int i=0; i<FFT_points/2; i++)
+       { FFT_output[i]=FFT_bins[i*FFT_SIZE/FFT_points];
+         FFT_noise[i]=myFFT.noiseFloor(i*FFT_SIZE/FFT_points);
+       }
+    }
+  return true;
+}
+
 void spectrum() { // spectrum analyser code by rheslip - modified
      #ifdef USETFT
-     if (myFFT.available()) {
+     if (read_FFT()) {
 //     if (fft1024_1.available()) {
     int16_t peak=0; uint16_t avgF=0;
     
@@ -801,21 +970,6 @@ void spectrum() { // spectrum analyser code by rheslip - modified
     int curF=int(freq_real/(sample_rate_real / FFT_points));
 
 //    for (int i = 0; i < 240; i++) {
-    //startup sequence to denoise the FFT
-    FFTcount++;
-    if (FFTcount==1)
-     {for (int16_t i = 0; i < 128; i++) {
-         FFTavg[i]=0; 
-     }
-     }
-
-    if (FFTcount<1000)
-     { 
-       for (int i = 0; i < 128; i++) {
-         FFTavg[i]=FFTavg[i]+abs(myFFT.output[i])*0.001; //0.1% of total values
-         }
-     }
-
 for (int16_t x = 2; x < 128; x++) {
    avgF=avgF+FFT_bin[x];
    if (FFT_bin[x]>peak)
@@ -832,7 +986,7 @@ if ((peak-avgF)<(avgF/3))
   */  
   for (int16_t x = 2; x < 128; x++) {
 //  for (uint16_t x = 8; x < 512; x+=4) {
-     FFT_bin[x] = (myFFT.output[x]);//-FFTavg[x]*0.9; 
+     FFT_bin[x] = (FFT_output[x]);//-FFT_noise[x]; 
      int colF=ENC_VALUE_COLOR;
      
 //     FFT_bin[x/4] = abs(fft1024_1.output[x]); 
@@ -881,12 +1035,34 @@ if ((peak-avgF)<(avgF/3))
 }
 #ifdef DEBUGSERIAL 
 
-/*void check_processor() {
-      if (second.check() == 1) {
+// once per second: load of the whole audio graph, of the granular node, of the FFT and of the tones,
+// the max values are the worst block since the last report, in percent of
+// one block period. The FFT gate was open for the given part of the blocks,
+// times the FFT max that is about its average load; wake up is the delay
+// from the block that opened it to the first frame.
+void check_processor() {
+      if (since_cpu_report > 1000) {
+      since_cpu_report = 0;
       Serial.print("Proc = ");
       Serial.print(AudioProcessorUsage());
       Serial.print(" (");    
       Serial.print(AudioProcessorUsageMax());
+      Serial.print("),  granular = ");
+      Serial.print(granular1.processorUsage());
+      Serial.print(" (");    
+      Serial.print(granular1.processorUsageMax());
+      Serial.print("),  FFT = ");
+      Serial.print(myFFT.processorUsage());
+      Serial.print(" (");    
+      Serial.print(myFFT.processorUsageMax());
+      Serial.print("),  FFT gate open ");
+      Serial.print(myFFT.gateDuty());
+      Serial.print("%, wake up ");
+      Serial.print(myFFT.gateLatency());
+      Serial.print(" samples,  tones = ");
+      Serial.print(goertzel1.processorUsage());
+      Serial.print(" (");    
+      Serial.print(goertzel1.processorUsageMax());
       Serial.print("),  Mem = ");
       Serial.print(AudioMemoryUsage());
       Serial.print(" (");    
@@ -894,16 +1070,90 @@ if ((peak-avgF)<(avgF/3))
       Serial.println(")");
  
       AudioProcessorUsageMaxReset();
+      granular1.processorUsageMaxReset();
+      myFFT.processorUsageMaxReset();
+      myFFT.gateDutyReset();
+      goertzel1.processorUsageMaxReset();
       AudioMemoryUsageMaxReset();
     }
 
 
 }
-*/ // END function check_processor
+ // END function check_processor
 #endif
 
 
 
+// waterfall of the zoomFFT, 240 of its 256 bins around 55kHz
+void zoomwaterfall(void)
+{
+#ifdef USETFT
+ if (zoomFFT.available()) {
+  static int count = TOP_OFFSET;
+  uint16_t FFT_pixels[240]; 
+  for (int i = 0; i < 240; i++) {
+     int val = zoomFFT.output[i+8]*10 + 10; 
+     FFT_pixels[i] = tft.color565(
+              min(255, val/2),
+              (val/6>255)? 255 : val/6,
+              0 ); 
+    }
+  tft.writeRect( 0,count, ILI9341_TFTWIDTH,1, (uint16_t*) &FFT_pixels); 
+  tft.setScroll(count);
+  count++;
+  if (count >= ILI9341_TFTHEIGHT-BOTTOM_OFFSET) count = TOP_OFFSET;
+ }
+#endif
+}
+
+// one bar per goertzel1 frequency, -80 to 0dB of full scale. A level 4x (12dB)
+// above its background shows in the menu colour: that species is calling
+void tonebars(void)
+{
+#ifdef USETFT
+ if ((since_tonebars>50) and goertzel1.available()) {
+  since_tonebars=0;
+  tft.setFont(Arial_16);
+  for (int i=0; i<tone_count; i++)
+   { float level=goertzel1.read(i);
+     boolean present=(level>4*tone_background[i]);
+     //the background drops at once and rises slowly, calls hardly lift it
+     if (level<tone_background[i])
+       { tone_background[i]=level;}
+     else
+       { tone_background[i]+=(level-tone_background[i])*0.01;}
+     if (tone_background[i]<0.00001) 
+       { tone_background[i]=0.00001;}
+
+     int bar=0;
+     if (level>0.0001) 
+       { bar=(20*log10f(level)+80)*180/80;}
+     bar=constrain(bar,0,180);
+     int y=TOP_OFFSET+10+i*30;
+     tft.setCursor(0,y);
+     tft.setTextColor(ENC_VALUE_COLOR);
+     tft.print(int(tone_freq[i]/1000));
+     tft.fillRect(50,y,bar,20,present ? ENC_MENU_COLOR : ENC_VALUE_COLOR);
+     tft.fillRect(50+bar,y,180-bar,20,COLOR_BLACK);
+   }
+
+  // passes per species group of the classifier, the last group highlighted
+  if (species_changed)
+   { species_changed=false;
+     int y=TOP_OFFSET+10+tone_count*30+10;
+     tft.fillRect(0,y,240,ILI9341_TFTHEIGHT-BOTTOM_OFFSET-y,COLOR_BLACK);
+     for (int g=1; g<BATCLASS_COUNT; g++)
+      { tft.setCursor((g-1)%2*120,y+(g-1)/2*20);
+        tft.setTextColor((g==last_species) ? ENC_MENU_COLOR : ENC_VALUE_COLOR);
+        tft.print(BatCallClassifier::name(g));
+        tft.print(" ");
+        tft.print(classifier.passes(g));
+      }
+   }
+ }
+#endif
+}
+
 void waterfall(void) // thanks to Frank B !
 { 
   
@@ -911,49 +1161,20 @@ void waterfall(void) // thanks to Frank B !
 
 // code for 256 point FFT 
      
- if (myFFT.available()) {
+ if (read_FFT()) {
   const uint16_t Y_OFFSET = TOP_OFFSET;
   static int count = TOP_OFFSET;
   //int curF=int(freq_real/(sample_rate_real / FFT_points));
 
-  // lowest frequencybin to detect as a batcall
-  int batCall_LoF_bin= int(30000/(sample_rate_real / FFT_points));
-  int batCall_HiF_bin= int(80000/(sample_rate_real / FFT_points));
-
   uint16_t FFT_pixels[240]; // maximum of 240 pixels, each one is the result of one FFT 
   FFT_pixels[0]=0; FFT_pixels[1]=0;  FFT_pixels[2]=0; FFT_pixels[3]=0;
   
-    FFTcount++;
 
-    //requested to start with a clean FFTavg array to denoise
-    if (FFTcount==1)
-       {for (int16_t i = 0; i < 128; i++) {
-          FFTavg[i]=0; 
-       }
-     }
-
-    // collect 1000 FFT samples for the denoise array
-    if (FFTcount<100)
-     { for (int i = 2; i < 128; i++) {
-         //FFTavg[i]=FFTavg[i]+myFFT.read(i)*65536.0*5*0.001; //0.1% of total values
-         FFTavg[i]=FFTavg[i]+myFFT.output[i]*10*0.001; //0.1% of total values
-         }
-     }
-    
-
-    int FFT_peakF_bin=0; 
-    int peak=512;
-    int avgFFTbin=0;
     // there are 128 FFT different bins only 120 are shown on the graphs  
     
     for (int i = 2; i < 120; i++) { 
-      int val = myFFT.output[i]*10 -FFTavg[i]*0.9 + 10; //v1
-      avgFFTbin+=val;
-      //detect the peakfrequency
-      if (val>peak)
-       { peak=val; 
-         FFT_peakF_bin=i;
-        }
+      // only what stands out from the noise floor of myFFT lights up 
+      int val = (FFT_output[i] -FFT_noise[i])*10 + 10; 
        if (val<5) 
            {val=5;}
 
@@ -967,23 +1188,16 @@ void waterfall(void) // thanks to Frank B !
        
       FFT_pixels[i*2+1]=FFT_pixels[i*2];       
     }
-    avgFFTbin=avgFFTbin/120;
-    //mark the peak
-    //FFT_pixels[FFT_peakF_bin*2]=COLOR_RED;
-    //FFT_pixels[FFT_peakF_bin*2+1]=COLOR_RED;
-   if ((peak/avgFFTbin)<1.2) //very low peakvalue so probably noise
-     { FFT_peakF_bin=0; 
-     }
 
   int powerSpectrum_Maxbin=0;
-  // detected a peak in the bat frequencies
-  if ((FFT_peakF_bin>batCall_LoF_bin) and (FFT_peakF_bin<batCall_HiF_bin))
+  // myFFT detected a call
+  if (batTrigger)
   {
     //collect data for the powerspectrum 
     for (int i = 2; i < 120; i++)
      { 
         //add new samples
-        FFTpowerspectrum[i]+=myFFT.output[i];
+        FFTpowerspectrum[i]+=FFT_output[i];
         //keep track of the maximum
         if (FFTpowerspectrum[i]>powerspectrum_Max) 
            { powerspectrum_Max=FFTpowerspectrum[i];
@@ -1001,6 +1215,15 @@ void waterfall(void) // thanks to Frank B !
          tft.fillRect(0,TOP_OFFSET-50,240,45, COLOR_BLACK);
          // keep a minimum maximumvalue to the powerspectrum
          int binLo=2; int binHi=0;
+         // peak between the bins, parabola through the maximum and its neighbours
+         float peakbin=powerSpectrum_Maxbin;
+         if ((powerSpectrum_Maxbin>2) and (powerSpectrum_Maxbin<119))
+           { float l=FFTpowerspectrum[powerSpectrum_Maxbin-1];
+             float c=FFTpowerspectrum[powerSpectrum_Maxbin];
+             float r=FFTpowerspectrum[powerSpectrum_Maxbin+1];
+             if ((2*c-l-r)>0)
+               { peakbin+=0.5*(r-l)/(2*c-l-r);}
+           }
 
          for (int i=2; i<120; i++)
           {             
@@ -1036,7 +1259,7 @@ void waterfall(void) // thanks to Frank B !
          tft.print(int(binLo*multiplier) );
          tft.print(" ");
          tft.setTextColor(ENC_MENU_COLOR);
-         tft.print(int(powerSpectrum_Maxbin*multiplier) );
+         tft.print(peakbin*multiplier,1);
          tft.print(" ");
          tft.setTextColor(ENC_VALUE_COLOR);
          tft.print(int(binHi*multiplier) );
@@ -1044,59 +1267,12 @@ void waterfall(void) // thanks to Frank B !
        }
       
     
-    if ((FFT_peakF_bin>batCall_LoF_bin) and (FFT_peakF_bin<batCall_HiF_bin)) // we got a high-frequent signal peak
-      { 
-        // when a batcall is first discovered 
-        if (not batTrigger) 
-          { since_bat_detection1=0; //start of the call mark
-            //clicker=0;
-            FFT_pixels[5]=ENC_VALUE_COLOR; // mark the start on the screen
-            FFT_pixels[6]=ENC_VALUE_COLOR;
-            FFT_pixels[7]=ENC_VALUE_COLOR;
-            
-            if (detector_mode==detector_Auto_heterodyne)
-               if (since_heterodyne>1000) //update the most every second
-                {freq_real=int((FFT_peakF_bin*(sample_rate_real / FFT_points)/500))*500; //round to nearest 500hz
-                 set_freq_Oscillator(freq_real); 
-                 since_heterodyne=0;
-                 //granular1.stop();
-                }
-            
-            //restart the TimeExpansion only if the previous call was played
-            if ((detector_mode==detector_Auto_TE) and (TE_ready) )
-             { granular1.stop();
-               granular1.beginTimeExpansion(GRANULAR_MEMORY_SIZE);
-               granular1.setSpeed(0.05);
-               TE_ready=false;
-               
-             }
-                      
-          }
-         //clicker++; 
-         batTrigger=true;
-         
-     }
-   else // FFT_peakF_bin does not show a battcall  
-        { 
-          if (batTrigger) //previous sample was still a call
-           { callLength=since_bat_detection1; // got a pause so store the time since the start of the call
-             
-             /*if (callLength>20) //call is too long 
-              { TE_ready=true; // break the TE replay
-                } 
-              */  
-              since_bat_detection2=0; //start timing the length of the replay
-             }
-          batTrigger=false;
-        }    
-    // restart TimeExpansion recording a bit after the call has finished completely
-    if ((!TE_ready) and (since_bat_detection2>(callLength*10)))
-      { //stop the time expansion
-        TE_ready=true;
-        granular1.stopTimeExpansion();
-       
+    if (batcall_mark) 
+      { batcall_mark=false;
+        FFT_pixels[5]=ENC_VALUE_COLOR; // mark the start on the screen
+        FFT_pixels[6]=ENC_VALUE_COLOR;
+        FFT_pixels[7]=ENC_VALUE_COLOR;
       }
-    
 
     if (since_bat_detection2<50) //keep scrolling 100ms after the last bat-call
       {  tft.writeRect( 0,count, ILI9341_TFTWIDTH,1, (uint16_t*) &FFT_pixels); //show a line with spectrumdata
@@ -1114,6 +1290,74 @@ void waterfall(void) // thanks to Frank B !
 
 }
 
+// handle the call start and end events of myFFT, runs in every display mode
+// and during recording
+void check_batcalls() {
+  batcall_event ev;
+  while (myFFT.readEvent(&ev))
+   { if (ev.type==BATCALL_START)
+       { since_bat_detection1=0; //start of the call mark
+         batcall_mark=(displaychoice==waterfallgraph);
+         //start of a call, jump to it
+         autoHTD_freq=ev.freq;
+         autoHTD_frames=0;
+         //record the call into the next free bank, the granular effect queues it for playback
+         if (((detector_mode==detector_Auto_TE) or (detector_mode==detector_HTD_TE)) and (TE_ready) )
+           { granular1.beginTimeExpansion(GRANULAR_MEMORY_SIZE);
+             granular1.setSpeed(0.05);
+             TE_ready=false;
+           }
+         batTrigger=true;
+       }
+     else 
+       { last_call=ev.features;
+         callLength=last_call.duration;
+         last_species=classifier.classify(last_call, millis());
+         species_changed=true;
+         #ifdef DEBUGSERIAL
+           Serial.printf("call %.1f ms, start %.0f end %.0f peak %.0f char %.0f Hz, bandwidth %.0f Hz, slope %.2f kHz/ms, interval %.0f ms: %s\n",
+              last_call.duration, last_call.fstart, last_call.fend, last_call.fpeak, last_call.fchar, last_call.bandwidth, last_call.slope, 
+              last_call.interval, BatCallClassifier::name(last_species));
+         #endif
+         since_bat_detection2=0; //start timing the length of the replay
+         batTrigger=false;
+         if ((detector_mode==detector_Auto_heterodyne) and (mode!=MODE_REC))
+           { display_settings(); //show the last tracked frequency
+           }
+       }
+   }
+
+  // the end event is lost when the queue is full, the detector's own state
+  // still ends the call
+  if (batTrigger and (!myFFT.inCall()))
+    { since_bat_detection2=0;
+      batTrigger=false;
+    }
+
+  // follow the running call, one step for every new frame of it
+  if ((detector_mode==detector_Auto_heterodyne) and batTrigger and (myFFT.callFrames()!=autoHTD_frames))
+    { autoHTD_frames=myFFT.callFrames();
+      autoHTD_freq+=autoHTD_gain*(myFFT.peakFrequency()-autoHTD_freq);
+      int freq=int(autoHTD_freq);
+      if (autoHTD_step>1)
+        { freq=int((autoHTD_freq+autoHTD_step/2)/autoHTD_step)*autoHTD_step;}
+      if (freq!=freq_real) 
+        { freq_real=freq;
+          track_freq_Oscillator(freq_real);
+        }
+    }
+
+  // close the TimeExpansion recording a bit after the call has finished completely
+  if ((!TE_ready) and (!batTrigger) and (since_bat_detection2>TE_tail))
+    { //the recorded call stays queued for playback
+      TE_ready=true;
+      granular1.stopTimeExpansion();
+      #ifdef DEBUGSERIAL
+        Serial.printf("TE trigger latency %ld samples\n", (long)granular1.triggerLatency());
+      #endif
+    }
+}
+
 void startRecording() {
   mode = MODE_REC;
   #ifdef USESD1
@@ -1199,6 +1443,7 @@ void startRecording() {
   outputMixer.gain(1,0);  //shutdown granular output      
   
   detector_mode=detector_heterodyne;
+  set_right_channel(right_mono);
 
   outputMixer.gain(0,1); 
   
@@ -1287,6 +1532,7 @@ if (EncLeft_menu_idx==MENU_PLY)
       outputMixer.gain(2,1);  //player to output 
       outputMixer.gain(1,0);  //shutdown granular output      
       outputMixer.gain(0,0);  //shutdown heterodyne output
+      set_right_channel(right_mono); //player on both channels
       EncRight_menu_idx=MENU_SR;
       EncRight_function=enc_value;
       freq_real_backup=freq_real; //keep track of heterodyne setting
@@ -1342,10 +1588,14 @@ if (EncLeft_menu_idx==MENU_PLY)
   freq_real=freq_real_backup;
   //restore heterodyne frequency
   set_freq_Oscillator (freq_real);
+  set_right_channel_for_mode();
 }
   outputMixer.gain(2,0); //stop the direct line output
   outputMixer.gain(1,1); // open granular output
   outputMixer.gain(0,1); // open heterodyne output  
+  if (detector_mode==detector_HTD_TE)
+    { outputMixer.gain(1,0); // granular stays on the right channel only
+    }
 
   inputMixer.gain(0,1); //switch on the mic-line
   inputMixer.gain(1,0); //switch off the playerline
@@ -1363,9 +1613,24 @@ void continuePlaying() {
   }
 }
 
+// setup the granular effect for triggered time expansion
+void begin_Auto_TE()
+{ granular1.beginTimeExpansion(GRANULAR_MEMORY_SIZE);
+  granular1.setSpeed(0.06); //default TE is 1/0.06 ~ 1/16 :TODO, switch from 1/x floats to divider value x
+  granular1.setInterpolation(GRANULAR_INTERP_HERMITE); //smooth playback instead of repeating samples
+  granular1.setPreTrigger(sample_rate_real/100); //keep 10ms from before the detection, covers the FFT and loop latency
+}
+
 void changeDetector_mode()
 {
-  if (detector_mode==detector_heterodyne)
+  if (detector_mode==detector_SSB)
+    heterodyne1.sideband(heterodyne_sideband); //only calls above (USB) or below (LSB) freq_real
+  else
+    heterodyne1.sideband(HETERODYNE_DSB);
+
+  set_right_channel_for_mode();
+
+  if ((detector_mode==detector_heterodyne) or (detector_mode==detector_SSB))
          { granular1.stop(); //stop other detecting routines
            outputMixer.gain(1,0);  //stop granular output      
            outputMixer.gain(0,1);  //start heterodyne output
@@ -1377,7 +1642,8 @@ void changeDetector_mode()
           
          } 
       if (detector_mode==detector_divider)
-         { granular1.beginDivider(GRANULAR_MEMORY_SIZE);
+         { granular1.setdivider(10); //output 1/10th of the input frequency
+           granular1.beginDivider(GRANULAR_MEMORY_SIZE);
            outputMixer.gain(1,1);  //start granular output      
            outputMixer.gain(0,0);  //shutdown heterodyne output
       
@@ -1390,10 +1656,9 @@ void changeDetector_mode()
          }  
 
       if (detector_mode==detector_Auto_TE)
-         { granular1.beginTimeExpansion(GRANULAR_MEMORY_SIZE);
+         { begin_Auto_TE();
            outputMixer.gain(1,1);  //start granular output      
            outputMixer.gain(0,0);  //shutdown heterodyne output
-           granular1.setSpeed(0.06); //default TE is 1/0.06 ~ 1/16 :TODO, switch from 1/x floats to divider value x
            //switch menu to volume/gain
            EncLeft_menu_idx=MENU_VOL;
            EncLeft_function=enc_value;
@@ -1401,6 +1666,28 @@ void changeDetector_mode()
            EncRight_function=enc_value;
 
          }  
+      if (detector_mode==detector_HTD_TE)
+         { begin_Auto_TE(); //time expansion on the right channel
+           outputMixer.gain(1,0);  //no granular output on the left      
+           outputMixer.gain(0,1);  //heterodyne output on the left
+          //switch menu to volume/frequency
+           EncLeft_menu_idx=MENU_VOL;
+           EncLeft_function=enc_value;
+           EncRight_menu_idx=MENU_FRQ;
+           EncRight_function=enc_value;
+
+         }  
+      if (detector_mode==detector_dual)
+         { granular1.stop(); //stop other detecting routines
+           outputMixer.gain(1,0);  //stop granular output      
+           outputMixer.gain(0,1);  //start heterodyne output, second heterodyne on the right
+          //switch menu to frequency/frequency2
+           EncLeft_menu_idx=MENU_FRQ;
+           EncLeft_function=enc_value;
+           EncRight_menu_idx=MENU_FRQ2;
+           EncRight_function=enc_value;
+          
+         } 
       if (detector_mode==detector_Auto_heterodyne)
          { granular1.stop(); 
            outputMixer.gain(1,0);  //stop granular output      
@@ -1509,11 +1796,7 @@ void updateEncoder(uint8_t Encoderside )
          mic_gain+=change;
          mic_gain=constrain(mic_gain,0,63);
          set_mic_gain(mic_gain);
-         FFTcount=0; //start denoise after changing gain
-         //reset FFTdenoise array
-         {for (int16_t i = 0; i < 128; i++) {
-           FFTavg[i]=0; 
-         }}  
+         myFFT.resetNoise(); //start the noise floor again at the new gain
         }
       /******************************FREQUENCY  ***************/
       if (menu_idx==MENU_FRQ)
@@ -1528,15 +1811,33 @@ void updateEncoder(uint8_t Encoderside )
               { delta=5000;}
 
           freq_real=freq_real+delta*change;
-          // limit the frequencies to 500hz steps
-          freq_real=constrain(freq_real,7000,int(sample_rate_real/2000)*1000-1000);
+          // limit the frequencies to 500hz steps, from 7k (or lower at low samplerates) up to Nyquist
+          freq_real=constrain(freq_real,min(7000,freq_Max()/2),freq_Max());
           set_freq_Oscillator (freq_real);
           lastmillis=millis();
          }
+      /******************************FREQUENCY 2 ***************/
+      if (menu_idx==MENU_FRQ2)
+         { int delta=500;
+           uint32_t currentmillis=millis();
+           //when turning the encoder fast make the change larger
+           if ((currentmillis-lastmillis)<500)
+              { delta=1000;}
+           if ((currentmillis-lastmillis)<250)
+              { delta=2000;}
+           if ((currentmillis-lastmillis)<100)
+              { delta=5000;}
+
+          freq_real2=freq_real2+delta*change;
+          freq_real2=constrain(freq_real2,min(7000,freq_Max()/2),freq_Max());
+          set_freq_Oscillator2 (freq_real2);
+          display_settings();
+          lastmillis=millis();
+         }
       /******************************DENOISE  ***************/
       if (menu_idx==MENU_DNS)
-        { // setting FFTcount to 0 activates a 1000 sample denoise
-          FFTcount=0;
+        { // the noise floor follows by itself, this starts it again
+          myFFT.resetNoise();
         }
       
       /******************************DISPLAY  ***************/
@@ -1544,17 +1845,19 @@ void updateEncoder(uint8_t Encoderside )
       if (menu_idx==MENU_DSP)
          { 
            displaychoice+=change;
-           displaychoice=displaychoice%3; //limit to 0(none),1(spectrum),2(waterfall)
-           if (displaychoice==waterfallgraph) 
+           displaychoice=displaychoice%5; //limit to 0(none),1(waterfall),2(spectrum),3(zoom),4(tones)
+           if ((displaychoice==waterfallgraph) or (displaychoice==zoomgraph)) 
               {
                tft.setRotation( 0 );
             }
-           if (displaychoice==spectrumgraph) 
+           set_zoom_band(); 
+           if ((displaychoice==spectrumgraph) or (displaychoice==tonegraph)) 
              { 
             tft.setScroll(0);
             tft.setRotation( 0 );
               }
             tft.fillScreen(COLOR_BLACK);
+            species_changed=true;
         }
 
       
@@ -1663,14 +1966,22 @@ void updateButtons()
    /*RIGHT MICROPUSH */
   if (micropushButton_R.risingEdge()) {
         detector_mode++;
-        if (detector_mode>detector_passive)
+        if (detector_mode>detector_last)
           {detector_mode=0;}
         changeDetector_mode();
         display_settings();      
     }
 /*LEFT MICROPUSH */
   if (micropushButton_L.risingEdge()) {
-      //no function yet
+      //switch sidebands in SSB mode
+      if (detector_mode==detector_SSB)
+        { if (heterodyne_sideband==HETERODYNE_USB)
+            heterodyne_sideband=HETERODYNE_LSB;
+          else
+            heterodyne_sideband=HETERODYNE_USB;
+          heterodyne1.sideband(heterodyne_sideband);
+          display_settings();
+        }
     }
 
 
@@ -1819,6 +2130,11 @@ void setup() {
   //sgtl5000.adcHighPassFilterDisable(); // does not help too much!
   sgtl5000.lineInLevel(0);
   mixFFT.gain(0,1);
+  myFFT.configure(FFT_SIZE, FFT_OVERLAP, FFT_WINDOW, FFT_bins);
+  myFFT.band(BAT_BAND_LO, BAT_BAND_HI);
+#ifdef FFT_GATE_RATIO
+  myFFT.gate(BAT_BAND_LO, BAT_BAND_HI, FFT_GATE_RATIO, FFT_GATE_HOLD);
+#endif
 
 // Init TFT display  
 #ifdef USETFT
@@ -1923,14 +2239,17 @@ inputMixer.gain(1,0); //player off
 outputMixer.gain(0,1); // heterodyne1 to output 
 outputMixer.gain(1,0); // granular to output off
 outputMixer.gain(2,0); // player to output off
+set_right_channel(right_mono); // right channel same as left
 
 // the Granular effect requires memory to operate
 granular1.begin(granularMemory, GRANULAR_MEMORY_SIZE);
+granular1.setBanks(GRANULAR_BANKS);
 
-// reset the FFT denoising array at startup
-for (int16_t i = 0; i < 128; i++) {
-  FFTavg[i]=0; 
-    }
+for (int i=0; i<tone_count; i++)
+  { goertzel1.frequency(i, tone_freq[i]);
+    tone_background[i]=1;
+  }
+goertzel1.length(tone_window);
 } // END SETUP
 
 
@@ -1946,6 +2265,10 @@ void loop() {
   }
 
 updateButtons();   
+check_batcalls();
+#ifdef DEBUGSERIAL
+check_processor();
+#endif
 // during recording only the left encoders button is used and screens are not updated
 if (mode!=MODE_REC)
 {
@@ -1959,6 +2282,14 @@ if (mode!=MODE_REC)
     if (displaychoice==spectrumgraph)
     {  spectrum();
      }
+   else
+    if (displaychoice==zoomgraph)
+    {  zoomwaterfall();
+     }
+   else
+    if (displaychoice==tonegraph)
+    {  tonebars();
+     }
  #endif
  }   
 
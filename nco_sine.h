@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2018, Cor Berrevoets, registax@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef nco_sine_h_
+#define nco_sine_h_
+
+#include <stdint.h>
+
+// 257 entry sine table from the audio library, Q15
+extern "C" {
+extern const int16_t AudioWaveformSine[257];
+}
+
+// Sine of a 32 bit phase, a full turn is 2^32, interpolated between table
+// entries, Q15. Shared by the oscillators of the heterodyne and zoom nodes.
+static inline int32_t nco_sine(uint32_t ph)
+{
+	uint32_t index = ph >> 24;
+	int32_t val1 = AudioWaveformSine[index];
+	int32_t val2 = AudioWaveformSine[index + 1];
+	uint32_t scale = (ph >> 8) & 0xFFFF;
+	return (val1 * (int32_t)(0x10000 - scale) + val2 * (int32_t)scale) >> 16;
+}
+
+#endif